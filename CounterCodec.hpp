@@ -0,0 +1,157 @@
+#pragma once
+
+#include <string.h>
+
+#include <vector>
+
+#include "configuration.hpp"
+
+namespace elastic_rose
+{
+    // Rosetta 传输格式中计数器数组的编码. 计数器按 64 个一块:
+    //   控制字节 0       之后是 varint n, 表示连续 n 个全零块
+    //   控制字节 w (1-8) 块内计数器都能用 w 位表示, 之后是 w 个 64 位的位平面,
+    //                    第 j 个位平面的第 i 位是块内第 i 个计数器的第 j 位
+    // 最后一块不足 64 个时按补零处理. 多字节整数按小端序存放.
+    // 解码时把位平面的每个字节查表展开成 8 个 0/1 字节, 移位后按位或进结果, 整块只有定长的
+    // 查表、移位和或运算, 没有逐个计数器的分支; 全零块直接跳过, 因此要求目标存储已清零.
+    class CounterCodec
+    {
+    public:
+        static const size_t kBlock = 64;
+
+        static void putVarint(std::vector<u8> &out, u64 v)
+        {
+            while (v >= 0x80)
+            {
+                out.push_back(u8(v) | 0x80);
+                v >>= 7;
+            }
+            out.push_back(u8(v));
+        }
+
+        static bool getVarint(const u8 *&in, const u8 *end, u64 &v)
+        {
+            v = 0;
+            for (u32 shift = 0; shift < 64 && in < end; shift += 7)
+            {
+                u8 byte = *in++;
+                v |= u64(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+
+        // 把 size 个计数器编码后追加到 out
+        static void encode(const u8 *counters, size_t size, std::vector<u8> &out)
+        {
+            const size_t blocks = (size + kBlock - 1) / kBlock;
+            u64 zero_run = 0;
+            u8 block[kBlock];
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                const u8 *src = counters + b * kBlock;
+                if ((b + 1) * kBlock > size)
+                {
+                    memset(block, 0, kBlock);
+                    memcpy(block, src, size - b * kBlock);
+                    src = block;
+                }
+                u64 words[8], bits = 0;
+                memcpy(words, src, kBlock);
+                for (int a = 0; a < 8; ++a)
+                    bits |= words[a];
+                if (bits == 0)
+                {
+                    zero_run++;
+                    continue;
+                }
+                if (zero_run > 0)
+                {
+                    out.push_back(0);
+                    putVarint(out, zero_run);
+                    zero_run = 0;
+                }
+                // 所有字节按位或之后的最高位决定位宽
+                u8 any = 0;
+                for (int a = 0; a < 8; ++a)
+                    any |= u8(bits >> (8 * a));
+                const u32 width = 32 - __builtin_clz(any);
+                out.push_back(u8(width));
+                for (u32 j = 0; j < width; ++j)
+                {
+                    u64 plane = 0;
+                    for (int a = 0; a < 8; ++a)
+                    {
+                        // 8 个字节的第 j 位收集成一个字节: 乘法把第 k 字节的最低位移到结果的第 56 + k 位
+                        u64 lsb = (words[a] >> j) & 0x0101010101010101ULL;
+                        plane |= ((lsb * 0x0102040810204080ULL) >> 56) << (8 * a);
+                    }
+                    u8 bytes[8];
+                    memcpy(bytes, &plane, 8);
+                    out.insert(out.end(), bytes, bytes + 8);
+                }
+            }
+            if (zero_run > 0)
+            {
+                out.push_back(0);
+                putVarint(out, zero_run);
+            }
+        }
+
+        // 把 in 中的 len 字节解码为 size 个计数器写入已清零的 dst; 数据格式错误或长度不符时返回 false
+        static bool decode(const u8 *in, size_t len, u8 *dst, size_t size)
+        {
+            const u64 *spread = spreadTable();
+            const u8 *end = in + len;
+            const size_t blocks = (size + kBlock - 1) / kBlock;
+            size_t b = 0;
+            while (in < end)
+            {
+                u8 width = *in++;
+                if (width == 0)
+                {
+                    u64 run;
+                    if (!getVarint(in, end, run) || run == 0 || run > blocks - b)
+                        return false;
+                    b += run;
+                    continue;
+                }
+                if (width > 8 || b >= blocks || size_t(end - in) < 8 * size_t(width))
+                    return false;
+                u64 words[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+                for (u32 j = 0; j < width; ++j, in += 8)
+                    for (int a = 0; a < 8; ++a)
+                        words[a] |= spread[in[a]] << j;
+                if ((b + 1) * kBlock <= size)
+                    memcpy(dst + b * kBlock, words, kBlock);
+                else
+                    memcpy(dst + b * kBlock, words, size - b * kBlock);
+                b++;
+            }
+            return b == blocks;
+        }
+
+    private:
+        // spread[x] 的第 k 个字节等于 x 的第 k 位
+        static const u64 *spreadTable()
+        {
+            struct Table
+            {
+                u64 value[256];
+                Table()
+                {
+                    for (u32 x = 0; x < 256; ++x)
+                    {
+                        value[x] = 0;
+                        for (u32 k = 0; k < 8; ++k)
+                            value[x] |= u64((x >> k) & 1) << (8 * k);
+                    }
+                }
+            };
+            static const Table table;
+            return table.value;
+        }
+    };
+} // namespace elastic_rose
@@ -10,24 +10,39 @@
 #include <string.h>
 #include <cmath>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <string>
 #include <assert.h>
 #include <iostream>
+#include <type_traits>
 
 #include "MurmurHash3.h"
+#include "RosettaStats.hpp"
 #include "configuration.hpp"
 
 using namespace std;
 
 namespace elastic_rose
 {
-    static void LeveldbBloomHash(const u64 key, u32 *out, u32 hash_code)
+    inline void LeveldbBloomHash(const u32 key, u32 *out, u32 hash_code)
+    {
+        MurmurHash3_x86_128((const char *)(&key), sizeof(u32), hash_code, out);
+    }
+
+    inline void LeveldbBloomHash(const u64 key, u32 *out, u32 hash_code)
     {
         MurmurHash3_x86_128((const char *)(&key), sizeof(u64), hash_code, out);
     }
 
-    static void LeveldbBloomHash(const string &key, u32 *out, u32 hash_code)
+    inline void LeveldbBloomHash(const u128 key, u32 *out, u32 hash_code)
+    {
+        MurmurHash3_x86_128((const char *)(&key), sizeof(u128), hash_code, out);
+    }
+
+    inline void LeveldbBloomHash(const string &key, u32 *out, u32 hash_code)
     {
         MurmurHash3_x86_128(key.c_str(), key.size(), hash_code, out);
     }
@@ -87,6 +102,11 @@ namespace elastic_rose
 
     class CountingBloomFilter
     {
+    public:
+        static const size_t kMaxProbes = 30;
+        static const size_t kBlockSize = 64; // 前缀局部哈希的块大小, 即一个 cache line
+        static const size_t kPageSize = 4096; // 共享模式下写时复制的粒度
+
     private:
         size_t bits_per_key_;
         size_t k_;
@@ -95,30 +115,102 @@ namespace elastic_rose
         size_t max_counter_value_ = 255;
         size_t expect_num_;
         size_t insert_num_;
-        std::vector<u8> filter_data_;
-    public:
-        CountingBloomFilter() = default;
-        CountingBloomFilter(size_t id) : id_(id){};
-        CountingBloomFilter(u64 total_size, double false_positive, u32 id)
-            : id_(id), insert_num_(0)
+        // 计数器数组; 独立使用时指向 owned_data_, 在 Rosetta 中指向共享的 LevelArena
+        u8 *filter_data_ = nullptr;
+        size_t filter_size_ = 0;
+        std::vector<u8> owned_data_;
+        bool dropped_ = false; // 已被丢弃的层对任何键都返回"可能存在"
+        // 共享模式下的分页存储 (此时 filter_data_ 为空): 页表与各页都按引用计数在副本间共享,
+        // 写入前复制仍被其他副本引用的页表和页. 每页单独分配, 最后一个引用释放时立即归还;
+        // page_bytes_ 统计所有副本中仍存活的页的总字节数
+        using Page = std::shared_ptr<u8>;
+        std::shared_ptr<std::vector<Page>> pages_;
+        std::shared_ptr<std::atomic<u64>> page_bytes_;
+#ifdef ROSETTA_STATS
+        u64 saturation_events_ = 0;
+#endif
+        bool prefix_local_ = false;
+        u32 child_shift_ = 0;
+        u32 child_bits_ = 0;
+
+        void init(u64 total_size, double false_positive)
         {
-            filter_data_.resize(total_size, 0);
+            filter_size_ = total_size;
             expect_num_ = calculate_n(total_size * 8 / counter_size_, false_positive);
             bits_per_key_ = (total_size * 8 / counter_size_ / expect_num_);
             // We intentionally round down to reduce probing cost a little bit
             k_ = static_cast<size_t>(bits_per_key_ * 0.69); // 0.69 =~ ln(2)
             if (k_ < 1)
                 k_ = 1;
-            if (k_ > 30)
-                k_ = 30;
+            if (k_ > kMaxProbes)
+                k_ = kMaxProbes;
+        }
+
+    public:
+        CountingBloomFilter() = default;
+        CountingBloomFilter(size_t id) : id_(id){};
+        CountingBloomFilter(u64 total_size, double false_positive, u32 id)
+            : id_(id), insert_num_(0)
+        {
+            owned_data_.resize(total_size, 0);
+            filter_data_ = owned_data_.data();
+            init(total_size, false_positive);
         }
 
-        size_t GetExpectNum()
+        // 使用外部提供的、已清零的存储 (不接管其生命周期)
+        CountingBloomFilter(u8 *data, u64 total_size, double false_positive, u32 id)
+            : id_(id), insert_num_(0), filter_data_(data)
+        {
+            init(total_size, false_positive);
+        }
+
+        // 由传输格式中的层描述恢复, data 为已清零的外部存储
+        CountingBloomFilter(u8 *data, u64 total_size, size_t k, size_t expect_num, size_t insert_num, u32 id)
+            : k_(k), id_(id), expect_num_(expect_num), insert_num_(insert_num), filter_data_(data),
+              filter_size_(total_size)
+        {
+            bits_per_key_ = expect_num_ ? filter_size_ * 8 / counter_size_ / expect_num_ : 0;
+        }
+
+        CountingBloomFilter(const CountingBloomFilter &other)
+        {
+            *this = other;
+        }
+
+        CountingBloomFilter &operator=(const CountingBloomFilter &other)
+        {
+            if (this == &other)
+                return *this;
+            bits_per_key_ = other.bits_per_key_;
+            k_ = other.k_;
+            id_ = other.id_;
+            expect_num_ = other.expect_num_;
+            insert_num_ = other.insert_num_;
+            filter_size_ = other.filter_size_;
+            dropped_ = other.dropped_;
+#ifdef ROSETTA_STATS
+            saturation_events_ = other.saturation_events_;
+#endif
+            prefix_local_ = other.prefix_local_;
+            child_shift_ = other.child_shift_;
+            child_bits_ = other.child_bits_;
+            owned_data_ = other.owned_data_;
+            filter_data_ = owned_data_.empty() ? other.filter_data_ : owned_data_.data();
+            pages_ = other.pages_;
+            page_bytes_ = other.page_bytes_;
+            return *this;
+        }
+
+        // vector 的移动不会改变其缓冲区地址, filter_data_ 无需重新绑定
+        CountingBloomFilter(CountingBloomFilter &&) = default;
+        CountingBloomFilter &operator=(CountingBloomFilter &&) = default;
+
+        size_t GetExpectNum() const
         {
             return expect_num_;
         }
 
-        size_t GetInsertNum()
+        size_t GetInsertNum() const
         {
             return insert_num_;
         }
@@ -128,22 +220,165 @@ namespace elastic_rose
             return max_counter_value_;
         }
 
-        u64 getMemoryUsage()
+        u64 getMemoryUsage() const
         {
-            return filter_data_.size();
+            return filter_size_;
         }
 
-        // 返回false代表实际插入的键已远大于预期键的数量,或是存在计数器溢出，需要重构
-        template<class T>
-        bool PutKey(const T &key)
+        // 连续存储的起始地址; 共享模式下为 nullptr
+        const u8 *data() const
         {
-            const size_t len = filter_data_.size();
+            return filter_data_;
+        }
 
-            u8 *array = &(filter_data_)[0];
-            const size_t bits = len * 8;
+        bool IsShared() const
+        {
+            return pages_ != nullptr;
+        }
+
+        // 把当前的计数器复制到单独分配的各页中, 改为分页存储; 之后不再引用原来的外部存储.
+        // 拷贝得到的副本与本对象共享计数器页, 任一方写入时只复制被写的页. page_bytes 累计存活页的字节数
+        void EnableSharing(const std::shared_ptr<std::atomic<u64>> &page_bytes)
+        {
+            assert(owned_data_.empty() && !pages_);
+            page_bytes_ = page_bytes;
+            auto table = std::make_shared<std::vector<Page>>();
+            for (size_t off = 0; off < filter_size_; off += kPageSize)
+            {
+                table->push_back(NewPage());
+                memcpy(table->back().get(), filter_data_ + off, PageLength(off / kPageSize));
+            }
+            pages_ = std::move(table);
+            filter_data_ = nullptr;
+        }
+
+        bool IsDropped() const
+        {
+            return dropped_;
+        }
+
+#ifdef ROSETTA_STATS
+        u64 GetSaturationEvents() const
+        {
+            return saturation_events_;
+        }
+
+        void ResetStats()
+        {
+            saturation_events_ = 0;
+        }
+#endif
+
+        // 能否再折半: 普通模式要求大小为偶数, 前缀局部模式要求块数为偶数, 且折半后不小于一个块
+        bool CanFold() const
+        {
+            if (dropped_ || filter_size_ < 2 * kBlockSize)
+                return false;
+            return prefix_local_ ? filter_size_ % (2 * kBlockSize) == 0 : filter_size_ % 2 == 0;
+        }
+
+        // 把计数器数组折半: 新位置 i 的计数为旧位置 i 与 i + size/2 之和.
+        // 位置由 h % size (前缀局部模式下为块号 h % blocks) 得到, 而 size/2 整除 size,
+        // 因此折半后所有键的位置都映射到原位置对应的新位置, 不会产生假阴性. k_ 保持不变.
+        void Fold()
+        {
+            assert(CanFold());
+            const size_t half = filter_size_ / 2;
+            for (size_t i = 0; i < half; ++i)
+            {
+                size_t low = *CounterAt(i), high = *CounterAt(i + half);
+                if (high != 0)
+                    *MutableCounter(i) = low + high < max_counter_value_ ? low + high : max_counter_value_;
+            }
+            if (pages_)
+            {
+                OwnPageTable();
+                pages_->resize((half + kPageSize - 1) / kPageSize);
+            }
+            filter_size_ = half;
+            expect_num_ = expect_num_ / 2 > 0 ? expect_num_ / 2 : 1;
+            bits_per_key_ = filter_size_ * 8 / counter_size_ / expect_num_;
+            if (!owned_data_.empty())
+            {
+                owned_data_.resize(half);
+                owned_data_.shrink_to_fit();
+                filter_data_ = owned_data_.data();
+            }
+        }
+
+        // 丢弃整层存储, 之后该层不再参与过滤
+        void Drop()
+        {
+            dropped_ = true;
+            filter_size_ = 0;
+            filter_data_ = nullptr;
+            pages_.reset();
+            std::vector<u8>().swap(owned_data_);
+        }
+
+        // 把全部计数器按顺序拷贝到 dst, 共享模式下也得到连续的一份
+        void CopyCounters(u8 *dst) const
+        {
+            if (pages_)
+            {
+                for (size_t off = 0; off < filter_size_; off += kPageSize)
+                    memcpy(dst + off, CounterAt(off), PageLength(off / kPageSize));
+            }
+            else if (filter_size_ > 0)
+                memcpy(dst, filter_data_, filter_size_);
+        }
+
+        // 把计数器拷贝到 dst 并改用 dst 作为连续存储 (dst 由调用者管理), 同时退出共享模式
+        void Relocate(u8 *dst)
+        {
+            CopyCounters(dst);
+            pages_.reset();
+            filter_data_ = dst;
+            std::vector<u8>().swap(owned_data_);
+        }
+
+        // 前缀局部哈希: 由父前缀决定所在的 cache line 块, 由 child_bits 个子位决定块内位置,
+        // 使同一父前缀下的所有兄弟前缀落在同一个块中. 要求 filter 大小是 kBlockSize 的整数倍.
+        void SetPrefixLocal(u32 child_shift, u32 child_bits)
+        {
+            prefix_local_ = true;
+            child_shift_ = child_shift;
+            child_bits_ = child_bits;
+        }
+
+        bool IsPrefixLocal() const
+        {
+            return prefix_local_;
+        }
+
+        size_t GetNumProbes() const
+        {
+            return k_;
+        }
+
+        // 一个 key 的探测状态: 哈希只算一次, 计数器的位置在检查时逐个计算
+        struct Probe
+        {
+            u32 h;
+            u32 delta;
+            u32 block; // 前缀局部模式下所在块的起始下标
+        };
+
+        // 计算 key 对应的 k_ 个计数器下标, pos 至少需要 kMaxProbes 个元素
+        template<class T>
+        void Locate(const T &key, u32 *pos) const
+        {
+            if constexpr (!std::is_same<T, std::string>::value)
+            {
+                if (prefix_local_)
+                {
+                    LocateLocal(key, pos);
+                    return;
+                }
+            }
+            const size_t bits = filter_size_ * 8;
             // Use double-hashing to generate a sequence of hash values.
             // See analysis in [Kirsch,Mitzenmacher 2006].
-            //u32 h = LeveldbBloomHash(keys[i]);
             u32 hbase[4];
             LeveldbBloomHash(key, hbase, id_);
             u32 h = hbase[0];
@@ -151,14 +386,87 @@ namespace elastic_rose
             for (size_t j = 0; j < k_; j++)
             {
                 const u32 bitpos = h % (bits / counter_size_);
-                if (array[bitpos / (8 / counter_size_)] < max_counter_value_) {
-                    (array[bitpos / (8 / counter_size_)])++;
-                } else {
+                pos[j] = bitpos / (8 / counter_size_);
+                h += delta;
+            }
+        }
+
+        // 计算 key 的哈希; 已丢弃的层不能调用
+        template<class T>
+        Probe StartProbe(const T &key) const
+        {
+            if constexpr (!std::is_same<T, std::string>::value)
+            {
+                if (prefix_local_)
+                    return StartLocalProbe(key);
+            }
+            u32 hbase[4];
+            LeveldbBloomHash(key, hbase, id_);
+            return {hbase[0], hbase[1], 0};
+        }
+
+        // 只预取第一个计数器, 供交错执行的查询在挂起前发出内存请求. 不存在的键大多在第一个计数器处结束,
+        // 一次预取全部 k 个计数器只会多出不需要的内存访问
+        void PrefetchProbe(const Probe &probe) const
+        {
+            if (filter_size_ < 2)
+                return;
+            if (prefix_local_)
+                __builtin_prefetch(CounterAt(probe.block + (probe.h & (kBlockSize - 1))));
+            else
+                __builtin_prefetch(CounterAt(u32(probe.h % (filter_size_ * 8 / counter_size_)) / (8 / counter_size_)));
+        }
+
+        // 与 KeyMayMatch 判断相同, 逐个计算位置, 遇到 0 即返回
+        bool MatchProbe(const Probe &probe) const
+        {
+            if (dropped_)
+                return true;
+            if (filter_size_ < 2)
+                return false;
+            u32 h = probe.h;
+            if (prefix_local_)
+            {
+                for (size_t j = 0; j < k_; j++)
+                {
+                    if (*CounterAt(probe.block + (h & (kBlockSize - 1))) == 0)
+                        return false;
+                    h += probe.delta;
+                }
+                return true;
+            }
+            const size_t bits = filter_size_ * 8;
+            for (size_t j = 0; j < k_; j++)
+            {
+                const u32 bitpos = h % (bits / counter_size_);
+                if (*CounterAt(bitpos / (8 / counter_size_)) == 0)
                     return false;
+                h += probe.delta;
+            }
+            return true;
+        }
+
+        // 返回false代表实际插入的键已远大于预期键的数量,或是存在计数器溢出，需要重构
+        // 饱和的计数器停留在 max_counter_value_ 上, 之后既不增加也不减少, 以免删除时出现假阴性
+        template<class T>
+        bool PutKey(const T &key)
+        {
+            if (dropped_)
+                return true;
+            u32 pos[kMaxProbes];
+            Locate(key, pos);
+            bool saturated = false;
+            for (size_t j = 0; j < k_; j++)
+            {
+                if (*CounterAt(pos[j]) < max_counter_value_) {
+                    (*MutableCounter(pos[j]))++;
+                } else {
+                    saturated = true;
                 }
-                h += delta;
             }
             insert_num_++;
+            ROSETTA_STAT(saturation_events_ += saturated);
+            if (saturated)    return false;
             if (insert_num_ > (expect_num_ * 2))    return false;
             return true;
         }
@@ -166,41 +474,88 @@ namespace elastic_rose
         template<class T>
         bool DeleteKey(const T &key)
         {
-            const size_t len = filter_data_.size();
-
-            u8 *array = &(filter_data_)[0];
-            const size_t bits = len * 8;
-            // Use double-hashing to generate a sequence of hash values.
-            // See analysis in [Kirsch,Mitzenmacher 2006].
-            //u32 h = LeveldbBloomHash(keys[i]);
-            u32 hbase[4];
-            LeveldbBloomHash(key, hbase, id_);
-            u32 h = hbase[0];
-            const u32 delta = hbase[1];
+            if (dropped_)
+                return true;
+            u32 pos[kMaxProbes];
+            Locate(key, pos);
             for (size_t j = 0; j < k_; j++)
             {
-                const u32 bitpos = h % (bits / counter_size_);
-                (array[bitpos / (8 / counter_size_)])--;
-                if (array[bitpos / (8 / counter_size_)] < 0) {
+                if (*CounterAt(pos[j]) == max_counter_value_)
+                    continue;
+                u8 *counter = MutableCounter(pos[j]);
+                (*counter)--;
+                if (*counter < 0) {
                     std::cout << "when delete key " << key << "counter < 0 !!" << std::endl;
                     assert(false);
                 }
-                h += delta;
             }
             insert_num_--;
             return true;
         }
 
+        // 批量应用计数器增量 (位置, 增量): 先按计数器所在的页做一趟计数排序, 写入时按地址顺序
+        // 访问各页. 每个增量的效果与对应次数的 PutKey / DeleteKey 相同, 饱和的计数器不再变化.
+        // keys 为净插入的键数
+        bool ApplyDeltas(const std::vector<std::pair<u32, int>> &deltas, long keys)
+        {
+            if (dropped_)
+                return true;
+            std::vector<u32> start(filter_size_ / kPageSize + 2, 0);
+            for (auto &d : deltas)
+                start[d.first / kPageSize + 1]++;
+            for (size_t p = 1; p < start.size(); ++p)
+                start[p] += start[p - 1];
+            std::vector<std::pair<u32, int>> sorted(deltas.size());
+            for (auto &d : deltas)
+                sorted[start[d.first / kPageSize]++] = d;
+
+            bool saturated = false;
+            for (auto &d : sorted)
+            {
+                const long counter = *CounterAt(d.first);
+                if (counter == long(max_counter_value_))
+                {
+                    saturated |= d.second > 0;
+                    continue;
+                }
+                long value = counter + d.second;
+                if (value > long(max_counter_value_))
+                {
+                    saturated = true;
+                    value = max_counter_value_;
+                }
+                *MutableCounter(d.first) = value > 0 ? value : 0;
+            }
+            insert_num_ += keys;
+            ROSETTA_STAT(saturation_events_ += saturated);
+            if (saturated)    return false;
+            if (insert_num_ > (expect_num_ * 2))    return false;
+            return true;
+        }
+
         template<class T>
         bool KeyMayMatch(const T &key) const
         {
-            const size_t len = filter_data_.size();
+            if (dropped_)
+                return true;
+            const size_t len = filter_size_;
             if (len < 2)
                 return false;
 
-            const u8 *array = &filter_data_[0];
-            const size_t bits = len * 8;
+            if (prefix_local_)
+            {
+                u32 pos[kMaxProbes];
+                Locate(key, pos);
+                for (size_t j = 0; j < k_; j++)
+                {
+                    if (*CounterAt(pos[j]) == 0)
+                        return false;
+                }
+                return true;
+            }
 
+            // 普通模式下逐个计算位置, 遇到 0 即可提前返回
+            const size_t bits = len * 8;
             u32 hbase[4];
             LeveldbBloomHash(key, hbase, id_);
             u32 h = hbase[0];
@@ -208,12 +563,90 @@ namespace elastic_rose
             for (size_t j = 0; j < k_; j++)
             {
                 const u32 bitpos = h % (bits / counter_size_);
-                if ((array[bitpos / (8 / counter_size_)]) == 0)
+                if (*CounterAt(bitpos / (8 / counter_size_)) == 0)
                     return false;
                 h += delta;
             }
             return true;
         }
+
+    private:
+        const u8 *CounterAt(size_t pos) const
+        {
+            if (!pages_)
+                return filter_data_ + pos;
+            return (*pages_)[pos / kPageSize].get() + pos % kPageSize;
+        }
+
+        // 返回可写的计数器; 共享模式下先复制仍被其他副本引用的页表与页 (写时复制).
+        // 引用计数只会被持有写权限的一方增加, 读到 1 之后不会再有其他副本访问该页.
+        u8 *MutableCounter(size_t pos)
+        {
+            if (!pages_)
+                return filter_data_ + pos;
+            OwnPageTable();
+            Page &page = (*pages_)[pos / kPageSize];
+            if (page.use_count() > 1)
+            {
+                Page copy = NewPage();
+                memcpy(copy.get(), page.get(), PageLength(pos / kPageSize));
+                page = std::move(copy);
+            }
+            else
+                std::atomic_thread_fence(std::memory_order_acquire); // 与其他副本释放该页时的 release 配对
+            return page.get() + pos % kPageSize;
+        }
+
+        Page NewPage()
+        {
+            page_bytes_->fetch_add(kPageSize, std::memory_order_relaxed);
+            std::shared_ptr<std::atomic<u64>> page_bytes = page_bytes_;
+            return Page(new u8[kPageSize], [page_bytes](u8 *p) {
+                delete[] p;
+                page_bytes->fetch_sub(kPageSize, std::memory_order_relaxed);
+            });
+        }
+
+        void OwnPageTable()
+        {
+            if (pages_.use_count() > 1)
+                pages_ = std::make_shared<std::vector<Page>>(*pages_);
+            else
+                std::atomic_thread_fence(std::memory_order_acquire); // 同 MutableCounter, 之后会原地修改页表
+        }
+
+        // 第 page 页中有效计数器的字节数, 最后一页可能不满
+        size_t PageLength(size_t page) const
+        {
+            const size_t rest = filter_size_ - page * kPageSize;
+            return rest < kPageSize ? rest : kPageSize;
+        }
+
+        // 前缀局部哈希: 由父前缀决定所在的块, 子位决定块内位置
+        template<class T>
+        Probe StartLocalProbe(const T &key) const
+        {
+            const T child_mask = (T(1) << child_bits_) - 1;
+            const T parent = key & ~(child_mask << child_shift_);
+            const u32 child = u32((key >> child_shift_) & child_mask);
+            u32 hbase[4];
+            LeveldbBloomHash(parent, hbase, id_);
+            const u32 block = (hbase[0] % (filter_size_ / kBlockSize)) * kBlockSize;
+            // 块内位置再混入子位, 步长取奇数保证 k_ 个位置在块内互不相同
+            return {fmix32(hbase[1] ^ (child * 0x9e3779b9)), fmix32(hbase[2] + child) | 1, block};
+        }
+
+        template<class T>
+        void LocateLocal(const T &key, u32 *pos) const
+        {
+            const Probe probe = StartLocalProbe(key);
+            u32 h = probe.h;
+            for (size_t j = 0; j < k_; j++)
+            {
+                pos[j] = probe.block + (h & (kBlockSize - 1));
+                h += probe.delta;
+            }
+        }
     };
 
 } // namespace elastic_rose
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+
+#include "MurmurHash3.h"
+#include "configuration.hpp"
+
+namespace elastic_rose
+{
+    // 已确认为空的 (前缀, 层) 的有界集合, 供 Rosetta::markEmpty 记住反复出现的假阳性.
+    // 组相联: 每条记录只能放在按哈希选出的一组 kWays 个槽中, 组满时按先进先出替换.
+    // 查找只读, 多个查找可以并发; insert / erase 不能与查找并发
+    template <typename Key>
+    class EmptyPrefixStash
+    {
+    public:
+        static const u32 kWays = 4;
+
+        EmptyPrefixStash() {}
+
+        // 槽数为不小于 entries 的 kWays x 2^n
+        explicit EmptyPrefixStash(size_t entries)
+        {
+            size_t sets = 1;
+            while (sets * kWays < entries)
+                sets <<= 1;
+            slots_.resize(sets * kWays);
+            next_.resize(sets, 0);
+        }
+
+        bool empty() const { return size_ == 0; }
+        size_t size() const { return size_; }
+        size_t capacity() const { return slots_.size(); }
+
+        bool contains(Key prefix, u32 level) const
+        {
+            if (size_ == 0)
+                return false;
+            const Slot *set = &slots_[setOf(prefix, level) * kWays];
+            for (u32 w = 0; w < kWays; ++w)
+                if (set[w].level == level + 1 && set[w].prefix == prefix)
+                    return true;
+            return false;
+        }
+
+        void insert(Key prefix, u32 level)
+        {
+            const size_t s = setOf(prefix, level);
+            Slot *set = &slots_[s * kWays];
+            Slot *free = nullptr;
+            for (u32 w = 0; w < kWays; ++w)
+            {
+                if (set[w].level == level + 1 && set[w].prefix == prefix)
+                    return;
+                if (set[w].level == 0 && free == nullptr)
+                    free = &set[w];
+            }
+            if (free == nullptr)
+            {
+                free = &set[next_[s]];
+                next_[s] = (next_[s] + 1) % kWays;
+            }
+            else
+                size_++;
+            free->prefix = prefix;
+            free->level = level + 1;
+        }
+
+        void erase(Key prefix, u32 level)
+        {
+            if (size_ == 0)
+                return;
+            Slot *set = &slots_[setOf(prefix, level) * kWays];
+            for (u32 w = 0; w < kWays; ++w)
+                if (set[w].level == level + 1 && set[w].prefix == prefix)
+                {
+                    set[w].level = 0;
+                    size_--;
+                    return;
+                }
+        }
+
+        u64 getMemoryUsage() const
+        {
+            return slots_.size() * sizeof(Slot) + next_.size();
+        }
+
+    private:
+        struct Slot
+        {
+            Key prefix = 0;
+            u32 level = 0; // 层号加一, 0 表示空槽
+        };
+        std::vector<Slot> slots_;
+        std::vector<u8> next_; // 各组满时下一个被替换的槽
+        size_t size_ = 0;
+
+        size_t setOf(Key prefix, u32 level) const
+        {
+            u32 h;
+            MurmurHash3_x86_32(&prefix, sizeof(Key), level, &h);
+            return h & (next_.size() - 1);
+        }
+    };
+} // namespace elastic_rose
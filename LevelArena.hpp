@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+#include <utility>
+
+#include "configuration.hpp"
+
+namespace elastic_rose
+{
+    const size_t kCacheLineSize = 64;
+    const size_t kHugePageSize = 2 * 1024 * 1024;
+
+    inline size_t roundUp(size_t size, size_t align)
+    {
+        return (size + align - 1) / align * align;
+    }
+
+    // Rosetta 所有层共用的一块连续内存, 每层的起始地址按 cache line 对齐.
+    // huge_pages 为 true 时优先使用 MAP_HUGETLB, 失败则退回普通页并通过
+    // madvise(MADV_HUGEPAGE) 请求透明大页. mmap 得到的内存已清零.
+    class LevelArena
+    {
+    public:
+        LevelArena() = default;
+
+        LevelArena(size_t size, bool huge_pages)
+        {
+            allocate(size, huge_pages);
+        }
+
+        ~LevelArena()
+        {
+            release();
+        }
+
+        LevelArena(const LevelArena &) = delete;
+        LevelArena &operator=(const LevelArena &) = delete;
+
+        LevelArena(LevelArena &&other) noexcept
+        {
+            *this = std::move(other);
+        }
+
+        LevelArena &operator=(LevelArena &&other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                data_ = other.data_;
+                size_ = other.size_;
+                mapped_ = other.mapped_;
+                map_base_ = other.map_base_;
+                huge_tlb_ = other.huge_tlb_;
+                other.data_ = nullptr;
+                other.size_ = other.mapped_ = 0;
+                other.map_base_ = nullptr;
+                other.huge_tlb_ = false;
+            }
+            return *this;
+        }
+
+        u8 *data() const { return data_; }
+        size_t size() const { return size_; }
+        // 是否真正拿到了 hugetlbfs 的 2MB 页 (透明大页无法在这里确认)
+        bool hugeTlb() const { return huge_tlb_; }
+
+        // 驻留内存的分配粒度
+        size_t pageSize() const
+        {
+            return huge_tlb_ ? kHugePageSize : size_t(sysconf(_SC_PAGESIZE));
+        }
+
+        // 把 [begin, begin + len) 中完整的页归还给系统, 之后读出为零. hugetlbfs 页无法部分归还
+        void discard(u8 *begin, size_t len)
+        {
+            if (huge_tlb_)
+                return;
+            const size_t page = pageSize();
+            size_t low = roundUp((size_t)begin, page);
+            size_t high = ((size_t)begin + len) / page * page;
+            if (high > low)
+                madvise((void *)low, high - low, MADV_DONTNEED);
+        }
+
+    private:
+        u8 *data_ = nullptr;
+        size_t size_ = 0;
+        size_t mapped_ = 0;
+        void *map_base_ = nullptr;
+        bool huge_tlb_ = false;
+
+        // mmap 失败时抛出 std::bad_alloc
+        void allocate(size_t size, bool huge_pages)
+        {
+            if (size == 0)
+                return;
+            if (huge_pages)
+            {
+                mapped_ = roundUp(size, kHugePageSize);
+                void *p = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (p != MAP_FAILED)
+                {
+                    map_base_ = p;
+                    data_ = (u8 *)p;
+                    huge_tlb_ = true;
+                    size_ = size;
+                    return;
+                }
+                // 多映射一个大页, 以便把起始地址对齐到 2MB
+                size_t len = mapped_ + kHugePageSize;
+                p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED)
+                    throw std::bad_alloc();
+                map_base_ = p;
+                mapped_ = len;
+                data_ = (u8 *)roundUp((size_t)p, kHugePageSize);
+                madvise(data_, roundUp(size, kHugePageSize), MADV_HUGEPAGE);
+                size_ = size;
+                return;
+            }
+            mapped_ = size;
+            void *p = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                throw std::bad_alloc();
+            map_base_ = p;
+            data_ = (u8 *)p;
+            size_ = size;
+        }
+
+        void release()
+        {
+            if (map_base_ != nullptr)
+                munmap(map_base_, mapped_);
+            data_ = nullptr;
+            map_base_ = nullptr;
+            size_ = mapped_ = 0;
+        }
+    };
+} // namespace elastic_rose
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "rosetta.hpp"
+
+namespace elastic_rose
+{
+    // 进程级的内存管控: 统计所有登记的 Rosetta 的 getMemoryUsage() 之和,
+    // 超出预算时按优先级从低到高逐步调用 Rosetta::shrink() 折半或丢弃层, 直到回到预算以内.
+    // 收缩分三轮: 先在所有实例上做不增加假阳性的折半, 再折半任意层, 所有实例都无法再折半后才丢弃层,
+    // 因此不会在其他实例还未收缩时就把某个实例的层全部丢弃.
+    // 被收缩的实例只会多出假阳性, 不会产生假阴性.
+    // 收缩发生在 track / setBudget / enforce 中, 此时被收缩的实例上不能有并发的读写;
+    // 实例析构前必须先 untrack.
+    class MemoryGovernor
+    {
+    public:
+        explicit MemoryGovernor(u64 budget) : budget_(budget) {}
+
+        // priority 越小越先被收缩
+        template <typename Key>
+        void track(Rosetta<Key> *filter, int priority)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Entry entry;
+            entry.id = filter;
+            entry.priority = priority;
+            entry.usage = [filter] { return filter->getMemoryUsage(); };
+            entry.shrink = [filter](ShrinkMode mode) { return filter->shrink(mode); };
+            entries_.push_back(std::move(entry));
+            enforceLocked();
+        }
+
+        template <typename Key>
+        void untrack(Rosetta<Key> *filter)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                          [filter](const Entry &e) { return e.id == filter; }),
+                           entries_.end());
+        }
+
+        void setBudget(u64 budget)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            budget_ = budget;
+            enforceLocked();
+        }
+
+        u64 getBudget()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return budget_;
+        }
+
+        u64 getMemoryUsage()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return usageLocked();
+        }
+
+        // 返回本次释放的字节数
+        u64 enforce()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return enforceLocked();
+        }
+
+    private:
+        struct Entry
+        {
+            const void *id;
+            int priority;
+            std::function<u64()> usage;
+            std::function<u64(ShrinkMode)> shrink;
+            bool exhausted = false;
+        };
+
+        std::mutex mutex_;
+        std::vector<Entry> entries_;
+        u64 budget_;
+
+        u64 usageLocked()
+        {
+            u64 total = 0;
+            for (auto &e : entries_)
+                total += e.usage();
+            return total;
+        }
+
+        u64 enforceLocked()
+        {
+            u64 total = usageLocked();
+            u64 released = 0;
+            for (ShrinkMode mode : {ShrinkMode::kFreeFold, ShrinkMode::kFold, ShrinkMode::kDrop})
+            {
+                for (auto &e : entries_)
+                    e.exhausted = false;
+                while (total > budget_)
+                {
+                    u64 freed = shrinkOne(mode);
+                    if (freed == 0)
+                        break;
+                    released += freed;
+                    total -= std::min(total, freed);
+                }
+            }
+            return released;
+        }
+
+        // 在优先级最低的实例中占用最大的那个上执行一步收缩, 返回释放的字节数, 0 表示所有实例都已无法收缩
+        u64 shrinkOne(ShrinkMode mode)
+        {
+            while (true)
+            {
+                // 优先级最低的实例中占用最大的那个
+                Entry *victim = nullptr;
+                u64 victim_usage = 0;
+                for (auto &e : entries_)
+                {
+                    if (e.exhausted)
+                        continue;
+                    u64 usage = e.usage();
+                    if (victim == nullptr || e.priority < victim->priority ||
+                        (e.priority == victim->priority && usage > victim_usage))
+                    {
+                        victim = &e;
+                        victim_usage = usage;
+                    }
+                }
+                if (victim == nullptr)
+                    return 0;
+                u64 freed = victim->shrink(mode);
+                if (freed > 0)
+                    return freed;
+                // 每次收缩至少释放一页, 返回 0 说明该方式下已无法继续
+                victim->exhausted = true;
+            }
+        }
+    };
+} // namespace elastic_rose
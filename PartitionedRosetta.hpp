@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "rosetta.hpp"
+
+namespace elastic_rose
+{
+    // 按键区间划分的 Rosetta: 键空间在若干分界点处切开, 每个分片是一个按自身键数分配空间的 Rosetta.
+    // 范围查询只分发到与范围相交、且含有键的分片; 没有键的分片不分配空间, 落在其中的查询不做任何探测.
+    // 分界点可以直接给出, 也可以由 learnBoundaries 从键的样本中学习.
+    template <typename Key = u64>
+    class PartitionedRosetta
+    {
+    public:
+        using key_type = Key;
+
+        // 分片的最小空间, 避免过小的层出现 expect_num_ 为 0
+        static const u64 kMinShardBytes = 4096;
+        // 预期为空的分片在第一次插入时创建, 按该键数分配空间
+        static const u64 kLazyShardKeys = 1024;
+
+        // boundaries 为升序的分界点 (不含 0), 分片 i 覆盖 [boundaries[i-1], boundaries[i] - 1];
+        // expected_keys[i] 为分片 i 的预期键数, 共 boundaries.size() + 1 个, 每个键分配 bits_per_key 位
+        PartitionedRosetta(const std::vector<Key> &boundaries, const std::vector<u64> &expected_keys,
+                           double bits_per_key, u32 alpha, double beta, double false_positive,
+                           const RosettaOptions &options = RosettaOptions())
+            : bits_per_key_(bits_per_key), alpha_(alpha), beta_(beta), false_positive_(false_positive),
+              options_(options)
+        {
+            assert(expected_keys.size() == boundaries.size() + 1);
+            lower_.push_back(0);
+            for (auto b : boundaries)
+            {
+                assert(b > lower_.back());
+                lower_.push_back(b);
+            }
+            shards_.resize(lower_.size());
+            keys_.resize(lower_.size(), 0);
+            for (size_t i = 0; i < shards_.size(); ++i)
+                if (expected_keys[i] > 0)
+                    shards_[i] = makeShard(expected_keys[i]);
+        }
+
+        // 从样本学习至多 shards 个等键数的分片, 另外把样本中明显的空洞 (宽于平均分片宽度的间隔)
+        // 以及样本最小值之前、最大值之后的区间切成单独的空分片. 空分片两侧各留出空洞宽度 1/16 的余量,
+        // 容纳样本之外的边缘键. expected_keys 为预期的总键数
+        static void learnBoundaries(std::vector<Key> sample, u64 expected_keys, u32 shards,
+                                    std::vector<Key> &boundaries, std::vector<u64> &counts)
+        {
+            boundaries.clear();
+            counts.clear();
+            if (sample.empty() || shards <= 1)
+            {
+                counts.push_back(expected_keys);
+                return;
+            }
+            std::sort(sample.begin(), sample.end());
+            const size_t n = sample.size();
+            std::vector<Key> cuts;
+            for (u32 i = 1; i < shards; ++i)
+                cuts.push_back(sample[i * n / shards]);
+
+            const Key threshold = (sample.back() - sample.front()) / shards;
+            std::vector<std::pair<Key, size_t>> gaps;
+            for (size_t i = 1; i < n; ++i)
+            {
+                Key gap = sample[i] - sample[i - 1];
+                if (gap > 1 && gap > threshold)
+                    gaps.push_back({gap, i});
+            }
+            std::sort(gaps.begin(), gaps.end(), [](const std::pair<Key, size_t> &a, const std::pair<Key, size_t> &b) {
+                return a.first > b.first;
+            });
+            if (gaps.size() > shards)
+                gaps.resize(shards);
+            for (auto &gap : gaps)
+            {
+                cuts.push_back(sample[gap.second - 1] + gap.first / 16 + 1);
+                cuts.push_back(sample[gap.second] - gap.first / 16);
+            }
+            cuts.push_back(sample.front() - sample.front() / 16);
+            if (sample.back() < KeyTraits<Key>::max_value)
+                cuts.push_back(sample.back() + (KeyTraits<Key>::max_value - sample.back()) / 16 + 1);
+
+            std::sort(cuts.begin(), cuts.end());
+            cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+            if (!cuts.empty() && cuts.front() == 0)
+                cuts.erase(cuts.begin());
+            boundaries = cuts;
+
+            std::vector<u64> hits(boundaries.size() + 1, 0);
+            for (auto key : sample)
+                hits[std::upper_bound(boundaries.begin(), boundaries.end(), key) - boundaries.begin()]++;
+            for (auto h : hits)
+                counts.push_back(h ? (u64)((u128(h) * expected_keys + n - 1) / n) : 0);
+        }
+
+        static PartitionedRosetta fromSample(const std::vector<Key> &sample, u64 expected_keys, u32 shards,
+                                             double bits_per_key, u32 alpha, double beta, double false_positive,
+                                             const RosettaOptions &options = RosettaOptions())
+        {
+            std::vector<Key> boundaries;
+            std::vector<u64> counts;
+            learnBoundaries(sample, expected_keys, shards, boundaries, counts);
+            return PartitionedRosetta(boundaries, counts, bits_per_key, alpha, beta, false_positive, options);
+        }
+
+        void insertKey(Key key)
+        {
+            size_t s = shardOf(key);
+            if (!shards_[s])
+                shards_[s] = makeShard(kLazyShardKeys);
+            shards_[s]->insertKey(key);
+            keys_[s]++;
+        }
+
+        // 只删除插入过的键; 分片为空或点查询为否 (没有假阴性) 说明键从未插入, 直接忽略,
+        // 避免计数回绕后影响分片的判空
+        void DeleteKey(Key key)
+        {
+            size_t s = shardOf(key);
+            if (keys_[s] == 0 || !shards_[s]->lookupKey(key))
+                return;
+            shards_[s]->DeleteKey(key);
+            keys_[s]--;
+        }
+
+        bool lookupKey(const Key &key) const
+        {
+            size_t s = shardOf(key);
+            return keys_[s] > 0 && shards_[s]->lookupKey(key);
+        }
+
+        // 范围按分片边界切开, 每段只交给对应的分片
+        bool range_query(Key low, Key high) const
+        {
+            if (low > high)
+                return false;
+            const size_t last = shardOf(high);
+            for (size_t s = shardOf(low); s <= last; ++s)
+            {
+                if (keys_[s] == 0)
+                    continue;
+                Key lo = std::max(low, lower_[s]);
+                Key hi = std::min(high, upper(s));
+                if (shards_[s]->range_query(lo, hi))
+                    return true;
+            }
+            return false;
+        }
+
+        size_t getShards() const { return shards_.size(); }
+
+        // 分片 i 覆盖的键区间 (闭区间)
+        std::pair<Key, Key> getShardRange(size_t i) const { return {lower_[i], upper(i)}; }
+
+        // 分片 i 的 Rosetta, 尚未分配时为 nullptr
+        Rosetta<Key> *getShard(size_t i) { return shards_[i].get(); }
+
+        u64 getShardKeys(size_t i) const { return keys_[i]; }
+
+        u64 getMemoryUsage()
+        {
+            u64 total = 0;
+            for (auto &shard : shards_)
+                if (shard)
+                    total += shard->getMemoryUsage();
+            return total;
+        }
+
+    private:
+        std::vector<Key> lower_; // 各分片的最小键, lower_[0] = 0
+        std::vector<std::unique_ptr<Rosetta<Key>>> shards_;
+        std::vector<u64> keys_;  // 各分片当前的键数 (插入减删除)
+        double bits_per_key_;
+        u32 alpha_;
+        double beta_;
+        double false_positive_;
+        RosettaOptions options_;
+
+        size_t shardOf(Key key) const
+        {
+            return std::upper_bound(lower_.begin(), lower_.end(), key) - lower_.begin() - 1;
+        }
+
+        Key upper(size_t i) const
+        {
+            return i + 1 < lower_.size() ? lower_[i + 1] - 1 : KeyTraits<Key>::max_value;
+        }
+
+        std::unique_ptr<Rosetta<Key>> makeShard(u64 keys) const
+        {
+            u64 bytes = u64(keys * bits_per_key_ / 8);
+            if (bytes < kMinShardBytes)
+                bytes = kMinShardBytes;
+            if (bytes > UINT32_MAX)
+                bytes = UINT32_MAX;
+            return std::unique_ptr<Rosetta<Key>>(
+                new Rosetta<Key>(bytes, alpha_, beta_, false_positive_, options_));
+        }
+    };
+} // namespace elastic_rose
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "configuration.hpp"
+
+namespace elastic_rose
+{
+    // 通过 perf_event_open 读取当前线程的硬件计数器 (仅用户态).
+    // 内核不允许或硬件不支持时 available() 返回 false, 读数全为 0.
+    class PerfCounters
+    {
+    public:
+        enum Event
+        {
+            kCycles,
+            kInstructions,
+            kCacheMisses,
+            kBranchMisses,
+            kNumEvents
+        };
+
+        PerfCounters()
+        {
+            static const u64 configs[kNumEvents] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            for (int i = 0; i < kNumEvents; ++i)
+            {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = configs[i];
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+                if (fds_[i] < 0)
+                    available_ = false;
+            }
+        }
+
+        ~PerfCounters()
+        {
+            for (int fd : fds_)
+                if (fd >= 0)
+                    close(fd);
+        }
+
+        PerfCounters(const PerfCounters &) = delete;
+        PerfCounters &operator=(const PerfCounters &) = delete;
+
+        bool available() const { return available_; }
+
+        void start()
+        {
+            for (int fd : fds_)
+                if (fd >= 0)
+                {
+                    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+                }
+        }
+
+        void stop()
+        {
+            for (int i = 0; i < kNumEvents; ++i)
+            {
+                values_[i] = 0;
+                if (fds_[i] < 0)
+                    continue;
+                ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+                u64 v = 0;
+                if (read(fds_[i], &v, sizeof(v)) == sizeof(v))
+                    values_[i] = v;
+            }
+        }
+
+        u64 value(Event e) const { return values_[e]; }
+
+    private:
+        int fds_[kNumEvents] = {-1, -1, -1, -1};
+        u64 values_[kNumEvents] = {0, 0, 0, 0};
+        bool available_ = true;
+    };
+} // namespace elastic_rose
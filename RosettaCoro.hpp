@@ -0,0 +1,410 @@
+#pragma once
+
+// 交错查询. 批量接口 lookupKeysInterleaved / rangeQueriesInterleaved 每批 width 个查询先计算哈希并
+// 预取第一个计数器, 再逐个检查, 让各自的 cache miss 相互重叠; 锚点通过的范围交给 range_query.
+// lookupTask / rangeQueryTask 是基于 C++20 协程的单个查询, 每探测一个前缀挂起一次, 由 InterleavedScheduler
+// 在同一线程上轮转执行, 适合与其他异步任务混合调度. 挂起与恢复的开销抵消了重叠带来的收益, 而顺序执行时
+// 乱序执行本来就能重叠相邻查询的访问, 所以不要单独用协程代替顺序查询, width 为 1 时也不要使用批量接口.
+// coro_bench 在 256MB 过滤器上 (单核虚拟机, 与顺序执行相比): 批量接口 width >= 8 时点查询 1.2-1.7x,
+// 长度 16 的范围 1.3-1.6x, 长度 1024 的范围 1.05-1.2x; 协程点查询 0.8-1.0x, 范围 0.57-0.9x.
+// 过滤器的布局与哈希保持不变, 结果与 lookupKey / range_query 完全一致.
+// 需要以 -std=c++20 编译; 只有交给 range_query 的范围计入 ROSETTA_STATS 统计.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "rosetta.hpp"
+
+namespace elastic_rose
+{
+    // 协程帧的线程本地空闲链表: 交错调度会不断创建同样大小的短命协程, 避免每次都走 malloc
+    class FrameAllocator
+    {
+    public:
+        static void *allocate(size_t size)
+        {
+            size_t bucket = (size + kGranularity - 1) / kGranularity;
+            if (bucket < kBuckets && !exited())
+            {
+                FreeNode *&head = freeList(bucket);
+                if (head != nullptr)
+                {
+                    FreeNode *node = head;
+                    head = node->next;
+                    return node;
+                }
+                return ::operator new(bucket * kGranularity);
+            }
+            return ::operator new(size);
+        }
+
+        static void deallocate(void *p, size_t size)
+        {
+            size_t bucket = (size + kGranularity - 1) / kGranularity;
+            if (bucket < kBuckets && !exited())
+            {
+                FreeNode *node = static_cast<FreeNode *>(p);
+                node->next = freeList(bucket);
+                freeList(bucket) = node;
+                return;
+            }
+            ::operator delete(p);
+        }
+
+    private:
+        static const size_t kGranularity = 64;
+        static const size_t kBuckets = 64; // 4KB 以内的帧, 含 128 位键的范围查询
+
+        struct FreeNode
+        {
+            FreeNode *next;
+        };
+
+        // 线程退出时把链表中的帧还给 operator delete; 之后再释放的帧不再缓存
+        struct FreeLists
+        {
+            FreeNode *heads[kBuckets] = {};
+
+            ~FreeLists()
+            {
+                for (FreeNode *&head : heads)
+                    while (head != nullptr)
+                    {
+                        FreeNode *node = head;
+                        head = node->next;
+                        ::operator delete(node);
+                    }
+                exited() = true;
+            }
+        };
+
+        static FreeNode *&freeList(size_t bucket)
+        {
+            thread_local FreeLists lists;
+            return lists.heads[bucket];
+        }
+
+        static bool &exited()
+        {
+            thread_local bool done = false;
+            return done;
+        }
+    };
+
+    // 返回 bool 的查询协程; 创建后处于挂起状态, 由调度器 resume
+    class ProbeTask
+    {
+    public:
+        struct promise_type
+        {
+            bool result = false;
+
+            ProbeTask get_return_object()
+            {
+                return ProbeTask(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_value(bool value) { result = value; }
+            void unhandled_exception() { std::terminate(); }
+
+            static void *operator new(size_t size) { return FrameAllocator::allocate(size); }
+            static void operator delete(void *p, size_t size) { FrameAllocator::deallocate(p, size); }
+        };
+
+        ProbeTask() = default;
+        explicit ProbeTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+        ProbeTask(ProbeTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+        ProbeTask &operator=(ProbeTask &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle_)
+                    handle_.destroy();
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+        ProbeTask(const ProbeTask &) = delete;
+        ProbeTask &operator=(const ProbeTask &) = delete;
+        ~ProbeTask()
+        {
+            if (handle_)
+                handle_.destroy();
+        }
+
+        void resume() { handle_.resume(); }
+        bool done() const { return handle_.done(); }
+        bool result() const { return handle_.promise().result; }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    // 一层中一个前缀的探测: 挂起前只预取第一个计数器, 恢复后与 KeyMayMatch 一样逐个检查并提前返回
+    struct LevelProbe
+    {
+        const CountingBloomFilter &bf;
+        CountingBloomFilter::Probe probe;
+
+        template <typename Key>
+        LevelProbe(const CountingBloomFilter &level, Key key) : bf(level), probe(level.StartProbe(key))
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) const noexcept { bf.PrefetchProbe(probe); }
+        bool await_resume() const { return bf.MatchProbe(probe); }
+    };
+
+    // 点查询: 一次预取 + 一次挂起
+    template <typename Key>
+    ProbeTask lookupTask(const Rosetta<Key> &rose, Key key)
+    {
+        // 精确模式没有可预取的层, 直接二分查找
+        if (rose.isExact())
+            co_return rose.exactMayContain(key, key);
+        const CountingBloomFilter &bf = rose.getLevel(rose.getLevels() - 1);
+        if (rose.bufferMayContain(key, key))
+            co_return true;
+        if (rose.stashCovers(key, rose.getLevels() - 1))
+            co_return false;
+        if (bf.IsDropped())
+            co_return true;
+        co_return co_await LevelProbe(bf, key);
+    }
+
+    // 范围查询: 与 range_query 相同的计划, 先探测公共前缀, 再按键序逐个取覆盖前缀, 用帧内的显式栈代替
+    // doubt 的递归, 每探测一个前缀挂起一次
+    template <typename Key>
+    ProbeTask rangeQueryTask(const Rosetta<Key> &rose, Key low, Key high)
+    {
+        if (rose.isExact())
+            co_return rose.exactMayContain(low, high);
+        if (rose.bufferMayContain(low, high))
+            co_return true;
+        Key anchor = 0;
+        int anchor_level = rose.rangeAnchor(low, high, anchor);
+        if (anchor_level >= 0 && rose.stashCovers(anchor, anchor_level))
+            co_return false;
+        if (anchor_level >= 0 && !rose.getLevel(anchor_level).IsDropped())
+        {
+            if (!co_await LevelProbe(rose.getLevel(anchor_level), anchor))
+                co_return false;
+        }
+        const u32 last = rose.getLevels() - 1;
+        const u32 alpha = rose.getAlpha();
+        // 以层号为下标的深度优先栈: 第 l 层待查的下一个子前缀及剩余个数, 最多 levels 层, 不需要堆分配
+        Key child[KeyTraits<Key>::bits];
+        u32 remaining[KeyTraits<Key>::bits];
+        int base = 0, top = -1; // top < base 时栈空, 取下一个覆盖前缀
+        Key from = low;
+        bool more = low <= high;
+        while (true)
+        {
+            Key prefix;
+            u32 l;
+            if (top >= base)
+            {
+                if (remaining[top] == 0)
+                {
+                    top--;
+                    continue;
+                }
+                prefix = child[top];
+                l = u32(top);
+                child[top] += Key(1) << ((last - l) * alpha);
+                remaining[top]--;
+            }
+            else
+            {
+                if (!more)
+                    break;
+                prefix = from;
+                l = rose.coveringLevel(from, high);
+                const Key end = from | ((Key(1) << ((last - l) * alpha)) - 1);
+                more = end < high;
+                from = end + 1;
+            }
+            // 与锚点相同的覆盖前缀已经探测过
+            const bool probed = anchor_level >= 0 && l == u32(anchor_level) && prefix == anchor;
+            if (!probed && rose.isStashed(prefix, l))
+                continue;
+            const CountingBloomFilter &bf = rose.getLevel(l);
+            if (bf.IsDropped() && (l == last || rose.getLevel(l + 1).IsDropped()))
+                co_return true;
+            if (!probed && !bf.IsDropped() && !co_await LevelProbe(bf, prefix))
+                continue;
+            if (l == last)
+                co_return true;
+            // 子前缀按键序出栈, 与 doubt 的探测顺序一致
+            if (top < base)
+                base = int(l) + 1;
+            top = int(l) + 1;
+            child[top] = prefix;
+            remaining[top] = u32(1) << alpha;
+        }
+        co_return false;
+    }
+
+    // 单线程轮转调度: 最多 width 个任务同时在途, 完成一个就补上下一个
+    class InterleavedScheduler
+    {
+    public:
+        explicit InterleavedScheduler(size_t width = 16) : width_(width == 0 ? 1 : width) {}
+
+        // make(i) 创建第 i 个任务, 其结果写入 results[i]; 不同任务可以查询不同的过滤器
+        template <class MakeTask>
+        void run(size_t n, MakeTask &&make, bool *results)
+        {
+            slots_.clear();
+            size_t next = 0;
+            while (slots_.size() < width_ && next < n)
+            {
+                slots_.push_back({make(next), next});
+                ++next;
+            }
+            while (!slots_.empty())
+            {
+                for (size_t i = 0; i < slots_.size();)
+                {
+                    Slot &slot = slots_[i];
+                    slot.task.resume();
+                    if (!slot.task.done())
+                    {
+                        ++i;
+                        continue;
+                    }
+                    results[slot.index] = slot.task.result();
+                    if (next < n)
+                    {
+                        slot.task = make(next);
+                        slot.index = next++;
+                        ++i;
+                    }
+                    else
+                    {
+                        slot = std::move(slots_.back());
+                        slots_.pop_back();
+                    }
+                }
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            ProbeTask task;
+            size_t index;
+        };
+
+        size_t width_;
+        std::vector<Slot> slots_;
+    };
+
+    // 点查询只有一个挂起点, 不经过协程: 每批 width 个键先计算哈希并预取第一个计数器, 再逐个检查.
+    // 结果与 lookupTask 相同, 省去了每个查询创建、恢复协程的开销
+    template <typename Key>
+    void lookupKeysInterleaved(const Rosetta<Key> &rose, const Key *keys, size_t n, bool *results,
+                               size_t width = 16)
+    {
+        if (width == 0)
+            width = 1;
+        const CountingBloomFilter *bf = rose.isExact() ? nullptr : &rose.getLevel(rose.getLevels() - 1);
+        std::vector<CountingBloomFilter::Probe> probes(width);
+        std::vector<bool> pending(width);
+        for (size_t begin = 0; begin < n; begin += width)
+        {
+            const size_t m = std::min(width, n - begin);
+            for (size_t j = 0; j < m; ++j)
+            {
+                const Key key = keys[begin + j];
+                bool &result = results[begin + j];
+                pending[j] = false;
+                if (bf == nullptr)
+                    result = rose.exactMayContain(key, key);
+                else if (rose.bufferMayContain(key, key))
+                    result = true;
+                else if (rose.stashCovers(key, rose.getLevels() - 1))
+                    result = false;
+                else if (bf->IsDropped())
+                    result = true;
+                else
+                {
+                    probes[j] = bf->StartProbe(key);
+                    bf->PrefetchProbe(probes[j]);
+                    pending[j] = true;
+                }
+            }
+            for (size_t j = 0; j < m; ++j)
+                if (pending[j])
+                    results[begin + j] = bf->MatchProbe(probes[j]);
+        }
+    }
+
+    // 大多数空范围在锚点处就能确定: 与 lookupKeysInterleaved 一样成批探测锚点. 锚点通过的范围
+    // 需要探测许多互不依赖的覆盖前缀, 乱序执行已经能让它们的 cache miss 重叠, 逐个挂起的协程反而
+    // 更慢 (见文件开头), 因此交给 range_query 完成
+    template <typename Key>
+    void rangeQueriesInterleaved(const Rosetta<Key> &rose, const std::pair<Key, Key> *ranges, size_t n,
+                                 bool *results, size_t width = 16)
+    {
+        if (width == 0)
+            width = 1;
+        std::vector<CountingBloomFilter::Probe> probes(width);
+        std::vector<int> levels(width);
+        std::vector<size_t> rest; // 本批中需要继续探测的范围
+        for (size_t begin = 0; begin < n; begin += width)
+        {
+            const size_t m = std::min(width, n - begin);
+            for (size_t j = 0; j < m; ++j)
+            {
+                const Key low = ranges[begin + j].first, high = ranges[begin + j].second;
+                bool &result = results[begin + j];
+                levels[j] = -1;
+                if (rose.isExact())
+                {
+                    result = rose.exactMayContain(low, high);
+                    continue;
+                }
+                if (rose.bufferMayContain(low, high))
+                {
+                    result = true;
+                    continue;
+                }
+                Key anchor = 0;
+                const int level = rose.rangeAnchor(low, high, anchor);
+                if (level >= 0 && rose.stashCovers(anchor, level))
+                    result = false;
+                else if (level < 0 || rose.getLevel(level).IsDropped())
+                    rest.push_back(begin + j);
+                else
+                {
+                    const CountingBloomFilter &bf = rose.getLevel(level);
+                    probes[j] = bf.StartProbe(anchor);
+                    bf.PrefetchProbe(probes[j]);
+                    levels[j] = level;
+                }
+            }
+            for (size_t j = 0; j < m; ++j)
+            {
+                if (levels[j] < 0)
+                    continue;
+                if (rose.getLevel(levels[j]).MatchProbe(probes[j]))
+                    rest.push_back(begin + j);
+                else
+                    results[begin + j] = false;
+            }
+            // range_query 会再探测一次锚点, 这时它已在 cache 中
+            for (size_t i : rest)
+                results[i] = rose.range_query(ranges[i].first, ranges[i].second);
+            rest.clear();
+        }
+    }
+} // namespace elastic_rose
+
+#endif // __cpp_impl_coroutine
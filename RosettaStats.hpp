@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "configuration.hpp"
+
+// 编译时加 -DROSETTA_STATS 开启 Rosetta 内部统计; 未定义时统计代码全部被预处理器移除.
+#ifdef ROSETTA_STATS
+#define ROSETTA_STAT(stmt) stmt
+#else
+#define ROSETTA_STAT(stmt)
+#endif
+
+namespace elastic_rose
+{
+    // 可拷贝的原子计数器, 并行查询时多个线程会同时累加; 使用 relaxed 序
+    struct AtomicCounter
+    {
+        std::atomic<u64> value{0};
+
+        AtomicCounter() = default;
+        AtomicCounter(const AtomicCounter &other) : value(other.load()) {}
+        AtomicCounter &operator=(const AtomicCounter &other)
+        {
+            value.store(other.load(), std::memory_order_relaxed);
+            return *this;
+        }
+
+        void add(u64 n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+        u64 load() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    // Rosetta::getStats() 返回的快照; 除 load_factor 外的计数只在 ROSETTA_STATS 下累加
+    struct RosettaStats
+    {
+        bool enabled = false;
+        u64 point_lookups = 0;
+        u64 range_queries = 0;
+        u64 stash_hits = 0;                 // 在空前缀表中命中而不再探测的次数
+        std::vector<u64> probes;            // 每层 KeyMayMatch 的次数
+        std::vector<u64> positives;         // 每层 KeyMayMatch 返回 true 的次数
+        std::vector<u64> saturation_events; // 每层 PutKey 遇到计数器饱和的次数
+        std::vector<u64> capacity_events;   // 每层插入数超过 expect_num_ * 2 后仍在插入的次数
+        std::vector<double> load_factor;    // 每层当前的 insert_num / expect_num
+        std::vector<u64> depth_histogram;   // 下标为单次范围查询探测到的最深层号
+    };
+} // namespace elastic_rose
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "configuration.hpp"
+
+namespace elastic_rose
+{
+    // 简单的工作窃取线程池: 每个工作线程有自己的双端队列, 从队尾取自己的任务,
+    // 空闲时从其他队列的队头窃取. 调用 runAll 的线程在等待期间也会参与窃取执行,
+    // 因此可以在池内任务中嵌套调用而不会死锁.
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        explicit ThreadPool(size_t threads)
+            : queues_(threads == 0 ? 1 : threads)
+        {
+            for (auto &q : queues_)
+                q.reset(new WorkQueue());
+            for (size_t i = 0; i < queues_.size(); ++i)
+                workers_.emplace_back([this, i] { workerLoop(i); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex_);
+                stop_ = true;
+            }
+            sleep_cv_.notify_all();
+            for (auto &t : workers_)
+                t.join();
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t size() const { return workers_.size(); }
+
+        // 把 tasks 分发到各个工作队列, 调用线程协助执行, 全部完成后返回
+        void runAll(std::vector<Task> &tasks)
+        {
+            if (tasks.empty())
+                return;
+            auto pending = std::make_shared<std::atomic<size_t>>(tasks.size());
+            for (size_t i = 0; i < tasks.size(); ++i)
+            {
+                Task task = std::move(tasks[i]);
+                push(i % queues_.size(), [task, pending] {
+                    task();
+                    pending->fetch_sub(1, std::memory_order_release);
+                });
+            }
+            while (pending->load(std::memory_order_acquire) != 0)
+            {
+                Task task;
+                if (steal(0, task))
+                    task();
+                else
+                    std::this_thread::yield();
+            }
+        }
+
+    private:
+        struct WorkQueue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkQueue>> queues_;
+        std::vector<std::thread> workers_;
+        std::mutex sleep_mutex_;
+        std::condition_variable sleep_cv_;
+        std::atomic<size_t> queued_{0};
+        bool stop_ = false;
+
+        void push(size_t index, Task task)
+        {
+            // 先计数再入队, 保证 queued_ 不小于实际的任务数
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex_);
+                queued_.fetch_add(1, std::memory_order_relaxed);
+            }
+            {
+                std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+                queues_[index]->tasks.push_back(std::move(task));
+            }
+            sleep_cv_.notify_one();
+        }
+
+        bool popLocal(size_t index, Task &task)
+        {
+            std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+            auto &tasks = queues_[index]->tasks;
+            if (tasks.empty())
+                return false;
+            task = std::move(tasks.back());
+            tasks.pop_back();
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // 从 start 开始依次尝试各个队列的队头
+        bool steal(size_t start, Task &task)
+        {
+            for (size_t i = 0; i < queues_.size(); ++i)
+            {
+                auto &q = *queues_[(start + i) % queues_.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.tasks.empty())
+                    continue;
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                queued_.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        void workerLoop(size_t index)
+        {
+            for (;;)
+            {
+                Task task;
+                if (popLocal(index, task) || steal(index + 1, task))
+                {
+                    task();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex_);
+                sleep_cv_.wait(lock, [this] {
+                    return stop_ || queued_.load(std::memory_order_relaxed) != 0;
+                });
+                if (stop_ && queued_.load(std::memory_order_relaxed) == 0)
+                    return;
+            }
+        }
+    };
+} // namespace elastic_rose
@@ -0,0 +1,146 @@
+// 对比 Rosetta 层存储布局的探测延迟:
+//   scattered: 每层单独 new 出的 CountingBloomFilter, 各自持有 vector (旧布局)
+//   arena:     所有层位于同一块连续 LevelArena 中, 层对象按值存放
+//   arena+hp:  同上, 并使用 2MB 大页
+// 用法: arena_bench [total_mb] [num_keys] [num_probes]
+// total_mb 默认 512, 应大于 LLC 才能体现 TLB / cache miss 的差异.
+
+#include <random>
+#include <chrono>
+
+#include "rosetta.hpp"
+
+using namespace elastic_rose;
+
+static const u32 kAlpha = 4;
+static const double kBeta = 0.5;
+static const double kFalsePositive = 0.01;
+
+static inline u64 mix(u64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// 旧布局: 每层一个独立的堆对象
+struct ScatteredLevels
+{
+    std::vector<CountingBloomFilter *> bfs;
+    u32 levels;
+
+    ScatteredLevels(const std::vector<u64> &sizes)
+    {
+        levels = sizes.size();
+        for (u32 i = 0; i < levels; ++i)
+            bfs.push_back(new CountingBloomFilter(sizes[i], kFalsePositive, i));
+    }
+
+    ~ScatteredLevels()
+    {
+        for (auto bf : bfs)
+            delete bf;
+    }
+
+    void insertKey(u64 key)
+    {
+        u64 base = (u64(1) << kAlpha) - 1;
+        u64 last = 0;
+        for (u32 i = 0; i < levels; ++i)
+        {
+            u64 mask = last + (base << (kAlpha * (levels - i - 1)));
+            bfs[i]->PutKey(key & mask);
+            last = mask;
+        }
+    }
+
+    // 自顶向下逐层探测 key 的前缀, 遇到否定即停止 (doubt 的探测模式)
+    u32 descend(u64 key)
+    {
+        u64 base = (u64(1) << kAlpha) - 1;
+        u64 last = 0;
+        for (u32 i = 0; i < levels; ++i)
+        {
+            u64 mask = last + (base << (kAlpha * (levels - i - 1)));
+            if (!bfs[i]->KeyMayMatch(key & mask))
+                return i;
+            last = mask;
+        }
+        return levels;
+    }
+};
+
+// arena 布局下同样的探测序列, 通过 Rosetta 公开的接口完成
+static u32 descend(Rosetta<u64> &rose, u64 key)
+{
+    u32 levels = rose.getLevels();
+    u64 base = (u64(1) << kAlpha) - 1;
+    u64 last = 0;
+    for (u32 i = 0; i < levels; ++i)
+    {
+        u64 mask = last + (base << (kAlpha * (levels - i - 1)));
+        if (!rose.levelMayMatch(i, key & mask))
+            return i;
+        last = mask;
+    }
+    return levels;
+}
+
+template <class F>
+static void run(const char *name, u64 num_probes, const std::vector<u64> &keys, F &&probe)
+{
+    // 依赖链: 下一个探测的键取决于上一次的结果, 使各次 miss 串行化, 测得的是延迟
+    u64 x = 0x1234567;
+    u64 depth = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (u64 i = 0; i < num_probes; ++i)
+    {
+        x = mix(x + depth);
+        u64 key = (i & 1) ? keys[x % keys.size()] : x;
+        depth += probe(key);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-10s %8.1f ns/probe  (avg levels probed %.2f)\n", name, ns / num_probes,
+           double(depth) / num_probes);
+}
+
+int main(int argc, char **argv)
+{
+    u64 total_mb = argc > 1 ? strtoull(argv[1], nullptr, 10) : 512;
+    u64 num_keys = argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000000;
+    u64 num_probes = argc > 3 ? strtoull(argv[3], nullptr, 10) : 2000000;
+    // 构造参数 total_size 为 u32
+    if (total_mb == 0 || total_mb * 1024 * 1024 > UINT32_MAX)
+    {
+        fprintf(stderr, "total_mb must be between 1 and %lu\n", u64(UINT32_MAX) / (1024 * 1024));
+        return 1;
+    }
+    u32 total_size = total_mb * 1024 * 1024;
+
+    std::mt19937_64 rng(42);
+    std::vector<u64> keys(num_keys);
+    for (auto &k : keys)
+        k = rng();
+
+    Rosetta<u64> arena(total_size, kAlpha, kBeta, kFalsePositive);
+    RosettaOptions hp_options;
+    hp_options.huge_pages = true;
+    Rosetta<u64> arena_hp(total_size, kAlpha, kBeta, kFalsePositive, hp_options);
+    ScatteredLevels scattered(arena.allocateSpace(total_size, kBeta, arena.getLevels()));
+
+    for (auto k : keys)
+    {
+        arena.insertKey(k);
+        arena_hp.insertKey(k);
+        scattered.insertKey(k);
+    }
+
+    printf("filter size %lu MB, %lu keys, %lu probes, hugetlb %s\n", total_mb, num_keys,
+           num_probes, arena_hp.usesHugeTlb() ? "yes" : "no (madvise)");
+    run("scattered", num_probes, keys, [&](u64 k) { return scattered.descend(k); });
+    run("arena", num_probes, keys, [&](u64 k) { return descend(arena, k); });
+    run("arena+hp", num_probes, keys, [&](u64 k) { return descend(arena_hp, k); });
+    return 0;
+}
@@ -0,0 +1,90 @@
+// Rosetta 传输格式的编码大小与编解码速度.
+// 对不同的键数: 输出原始计数器字节数、编码后字节数与压缩比, 编码速度, 以及解码速度
+// (按原始字节数计; codec 只计 CounterCodec::decode, rosetta 包含 arena 分配的完整 Rosetta::decode).
+// 每次解码后核对计数器与原过滤器完全一致.
+// 用法: codec_bench [total_mb] [keys,keys,...]
+
+#include <random>
+
+#include "rosetta.hpp"
+
+using namespace elastic_rose;
+
+int main(int argc, char **argv)
+{
+    u64 total_mb = argc > 1 ? strtoull(argv[1], nullptr, 10) : 64;
+    // 构造参数 total_size 为 u32
+    if (total_mb == 0 || total_mb * 1024 * 1024 > UINT32_MAX)
+    {
+        fprintf(stderr, "total_mb must be between 1 and %lu\n", u64(UINT32_MAX) / (1024 * 1024));
+        return 1;
+    }
+    std::vector<u64> key_counts = {10000, 100000, 1000000, 4000000};
+    if (argc > 2)
+    {
+        key_counts.clear();
+        for (char *p = argv[2]; *p;)
+        {
+            key_counts.push_back(strtoull(p, &p, 10));
+            if (*p == ',')
+                ++p;
+        }
+    }
+
+    printf("keys,raw_bytes,encoded_bytes,ratio,encode_mb_s,codec_decode_gb_s,rosetta_decode_gb_s\n");
+    for (u64 n : key_counts)
+    {
+        std::mt19937_64 rng(n);
+        Rosetta<u64> rose(total_mb * 1024 * 1024, 4, 0.5, 0.01);
+        for (u64 i = 0; i < n; ++i)
+            rose.insertKey(rng());
+
+        std::vector<u8> wire;
+        u64 start = getNowNs();
+        rose.encode(wire);
+        u64 encode_ns = getNowNs() - start;
+        const u64 raw = rose.getMemoryUsage();
+
+        // 只解码最大的一层, 计数器写入预先清零的缓冲区
+        const u32 last = rose.getLevels() - 1;
+        const CountingBloomFilter &bf = rose.getLevel(last);
+        std::vector<u8> level_wire, level_out(bf.getMemoryUsage());
+        CounterCodec::encode(bf.data(), bf.getMemoryUsage(), level_wire);
+        const int rounds = 5;
+        u64 codec_ns = 0;
+        for (int r = 0; r < rounds; ++r)
+        {
+            memset(level_out.data(), 0, level_out.size());
+            start = getNowNs();
+            bool ok = CounterCodec::decode(level_wire.data(), level_wire.size(), level_out.data(), level_out.size());
+            codec_ns += getNowNs() - start;
+            if (!ok || memcmp(level_out.data(), bf.data(), level_out.size()) != 0)
+            {
+                fprintf(stderr, "level decode mismatch\n");
+                return 1;
+            }
+        }
+
+        u64 rosetta_ns = 0;
+        for (int r = 0; r < rounds; ++r)
+        {
+            Rosetta<u64> copy;
+            start = getNowNs();
+            bool ok = Rosetta<u64>::decode(wire.data(), wire.size(), copy);
+            rosetta_ns += getNowNs() - start;
+            for (u32 i = 0; ok && i < rose.getLevels(); ++i)
+                ok = memcmp(copy.getLevel(i).data(), rose.getLevel(i).data(), rose.getLevel(i).getMemoryUsage()) == 0;
+            if (!ok)
+            {
+                fprintf(stderr, "decode mismatch\n");
+                return 1;
+            }
+        }
+
+        printf("%lu,%lu,%zu,%.2f,%.1f,%.2f,%.2f\n", n, raw, wire.size(), double(raw) / wire.size(),
+               raw * 1e3 / encode_ns, double(level_out.size()) * rounds / codec_ns,
+               double(raw) * rounds / rosetta_ns);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
 #include <time.h>
 #include <sys/time.h>
 
@@ -10,6 +13,68 @@ namespace elastic_rose
     using u16 = unsigned short;
     using u32 = unsigned int;
     using u64 = unsigned long;
+    using u128 = unsigned __int128;
+
+    // 键宽度相关的常量, Rosetta 的层数、掩码与哈希都依据它来确定
+    template <typename Key>
+    struct KeyTraits;
+
+    template <>
+    struct KeyTraits<u32>
+    {
+        static constexpr u32 bits = 32;
+        static constexpr u32 max_value = ~u32(0);
+    };
+
+    template <>
+    struct KeyTraits<u64>
+    {
+        static constexpr u32 bits = 64;
+        static constexpr u64 max_value = ~u64(0);
+    };
+
+    template <>
+    struct KeyTraits<u128>
+    {
+        static constexpr u32 bits = 128;
+        static constexpr u128 max_value = ~u128(0);
+    };
+
+    // 前导零的个数, x 不能为 0
+    inline u32 countLeadingZeros(u32 x)
+    {
+        return __builtin_clz(x);
+    }
+
+    inline u32 countLeadingZeros(u64 x)
+    {
+        return __builtin_clzl(x);
+    }
+
+    inline u32 countLeadingZeros(u128 x)
+    {
+        u64 hi = u64(x >> 64);
+        return hi ? __builtin_clzl(hi) : 64 + __builtin_clzl(u64(x));
+    }
+
+    inline std::string toString(u128 v)
+    {
+        if (v == 0)
+            return "0";
+        std::string ret;
+        while (v != 0)
+        {
+            ret.insert(ret.begin(), char('0' + int(v % 10)));
+            v /= 10;
+        }
+        return ret;
+    }
+
+    // 标准库不提供 __int128 的输出
+    inline std::ostream &operator<<(std::ostream &os, u128 v)
+    {
+        return os << toString(v);
+    }
 
     inline void align(char *&ptr)
     {
@@ -33,4 +98,12 @@ namespace elastic_rose
         gettimeofday(&tv, 0);
         return tv.tv_sec + tv.tv_usec / 1000000.0;
     }
+
+    // 单调时钟, 纳秒; 用于逐个操作的延迟测量
+    inline uint64_t getNowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
 } // namespace elastic_rose
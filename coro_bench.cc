@@ -0,0 +1,97 @@
+// 比较逐个执行的 lookupKey / range_query 与交错执行 (RosettaCoro.hpp 的批量接口与协程) 的吞吐,
+// 并检查结果完全一致. 需要 -std=c++20.
+// 用法: coro_bench [total_mb] [num_keys] [num_queries]
+
+#include <random>
+
+#include "RosettaCoro.hpp"
+#include "workload.hpp"
+
+using namespace elastic_rose;
+
+template <class F>
+static double timeNs(F &&f)
+{
+    u64 start = getNowNs();
+    f();
+    return double(getNowNs() - start);
+}
+
+int main(int argc, char **argv)
+{
+    u64 total_mb = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    u64 num_keys = argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000000;
+    u64 num_queries = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1000000;
+    // 构造参数 total_size 为 u32
+    if (total_mb == 0 || total_mb * 1024 * 1024 > UINT32_MAX)
+    {
+        fprintf(stderr, "total_mb must be between 1 and %lu\n", u64(UINT32_MAX) / (1024 * 1024));
+        return 1;
+    }
+
+    std::mt19937_64 rng(3);
+    Rosetta<u64> rose(total_mb * 1024 * 1024, 4, 0.5, 0.01);
+    std::vector<u64> keys(num_keys);
+    for (auto &k : keys)
+    {
+        k = rng();
+        rose.insertKey(k);
+    }
+
+    std::vector<u64> lookups(num_queries);
+    for (u64 i = 0; i < num_queries; ++i)
+        lookups[i] = (i & 1) ? keys[rng() % num_keys] : rng();
+
+    printf("filter %lu MB, %lu keys, %lu queries\n", total_mb, num_keys, num_queries);
+
+    std::unique_ptr<bool[]> expect(new bool[num_queries]);
+    std::unique_ptr<bool[]> got(new bool[num_queries]);
+    double base = timeNs([&] {
+        for (u64 i = 0; i < num_queries; ++i)
+            expect[i] = rose.lookupKey(lookups[i]);
+    });
+    printf("lookupKey   sequential        %7.1f ns/query\n", base / num_queries);
+    for (size_t width : {1, 4, 8, 16, 32, 64})
+    {
+        double ns = timeNs([&] { lookupKeysInterleaved(rose, lookups.data(), num_queries, got.get(), width); });
+        bool same = std::equal(expect.get(), expect.get() + num_queries, got.get());
+        printf("lookupKey   interleaved w=%-3zu %7.1f ns/query  %.2fx  %s\n", width, ns / num_queries,
+               base / ns, same ? "ok" : "MISMATCH");
+        if (!same)
+            return 1;
+    }
+    // 每个查询一个协程, 由 InterleavedScheduler 轮转
+    InterleavedScheduler scheduler(16);
+    double ns = timeNs([&] { scheduler.run(num_queries, [&](size_t i) { return lookupTask(rose, lookups[i]); }, got.get()); });
+    printf("lookupKey   coroutines  w=16  %7.1f ns/query  %.2fx  %s\n", ns / num_queries, base / ns,
+           std::equal(expect.get(), expect.get() + num_queries, got.get()) ? "ok" : "MISMATCH");
+
+    for (u64 range_len : {u64(16), u64(1024)})
+    {
+        u64 n = num_queries / 4;
+        std::vector<std::pair<u64, u64>> ranges(n);
+        for (auto &r : ranges)
+            r = makeRange(rng(), range_len);
+        base = timeNs([&] {
+            for (u64 i = 0; i < n; ++i)
+                expect[i] = rose.range_query(ranges[i].first, ranges[i].second);
+        });
+        printf("range %-5lu sequential        %7.1f ns/query\n", range_len, base / n);
+        for (size_t width : {1, 8, 32})
+        {
+            double ns = timeNs([&] { rangeQueriesInterleaved(rose, ranges.data(), n, got.get(), width); });
+            bool same = std::equal(expect.get(), expect.get() + n, got.get());
+            printf("range %-5lu interleaved w=%-3zu %7.1f ns/query  %.2fx  %s\n", range_len, width, ns / n,
+                   base / ns, same ? "ok" : "MISMATCH");
+            if (!same)
+                return 1;
+        }
+        double ns = timeNs([&] {
+            scheduler.run(n, [&](size_t i) { return rangeQueryTask(rose, ranges[i].first, ranges[i].second); },
+                          got.get());
+        });
+        printf("range %-5lu coroutines  w=16  %7.1f ns/query  %.2fx  %s\n", range_len, ns / n, base / ns,
+               std::equal(expect.get(), expect.get() + n, got.get()) ? "ok" : "MISMATCH");
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+// Rosetta 构造参数 (total_size, alpha, beta, false_positive) 的 FPR-内存探索工具.
+// 对每组参数: 插入键集, 执行范围查询, 用有序键数组作为精确结果逐一核对,
+// 输出实际的 bits/key、空范围上的假阳性率与每次查询耗时; 出现假阴性时立即报错退出.
+// 最后输出 (bits/key, fpr, ns/query) 上的 Pareto 前沿.
+//
+// 用法: fpr_explorer [--keys=N] [--queries=N] [--dist=uniform] [--ranges=1,16,1024]
+//                    [--bits=64,128,256] [--alpha=2,4,8] [--beta=0.5,0.75,1] [--fp=0.01,0.001]
+
+#include <algorithm>
+
+#include "rosetta.hpp"
+#include "workload.hpp"
+
+using namespace elastic_rose;
+
+struct ExplorerConfig
+{
+    u64 num_keys = 100000;
+    u64 num_queries = 20000;
+    KeyDistribution dist = KeyDistribution::kUniform;
+    std::vector<u64> range_lens = {1, 16, 1024};
+    std::vector<double> bits_per_key = {64, 128, 256}; // 每个计数器占 8 bit
+    std::vector<double> alphas = {2, 4, 8};
+    std::vector<double> betas = {0.5, 0.75, 1.0};
+    std::vector<double> false_positives = {0.01, 0.001};
+};
+
+struct Point
+{
+    u64 total_size;
+    u32 alpha;
+    double beta;
+    double false_positive;
+    double bits_per_key; // 按 getMemoryUsage() 计算的实际值
+    double fpr;
+    double ns_per_query;
+};
+
+static std::vector<double> parseList(const std::string &s)
+{
+    std::vector<double> values;
+    size_t start = 0;
+    while (start < s.size())
+    {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos)
+            end = s.size();
+        values.push_back(strtod(s.substr(start, end - start).c_str(), nullptr));
+        start = end + 1;
+    }
+    return values;
+}
+
+static bool parseArgs(int argc, char **argv, ExplorerConfig &config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--keys")
+            config.num_keys = strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--queries")
+            config.num_queries = strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--dist")
+        {
+            if (!parseDistribution(value, config.dist))
+            {
+                fprintf(stderr, "unknown distribution %s\n", value.c_str());
+                return false;
+            }
+        }
+        else if (name == "--ranges")
+        {
+            config.range_lens.clear();
+            for (double r : parseList(value))
+                config.range_lens.push_back(u64(r));
+        }
+        else if (name == "--bits")
+            config.bits_per_key = parseList(value);
+        else if (name == "--alpha")
+            config.alphas = parseList(value);
+        else if (name == "--beta")
+            config.betas = parseList(value);
+        else if (name == "--fp")
+            config.false_positives = parseList(value);
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool oracle(const std::vector<u64> &sorted, u64 low, u64 high)
+{
+    auto it = std::lower_bound(sorted.begin(), sorted.end(), low);
+    return it != sorted.end() && *it <= high;
+}
+
+static bool dominates(const Point &a, const Point &b)
+{
+    bool no_worse = a.bits_per_key <= b.bits_per_key && a.fpr <= b.fpr && a.ns_per_query <= b.ns_per_query;
+    bool better = a.bits_per_key < b.bits_per_key || a.fpr < b.fpr || a.ns_per_query < b.ns_per_query;
+    return no_worse && better;
+}
+
+static void printPoint(const Point &p)
+{
+    printf("%lu,%u,%.2f,%g,%.2f,%.6f,%.1f\n", p.total_size, p.alpha, p.beta, p.false_positive,
+           p.bits_per_key, p.fpr, p.ns_per_query);
+}
+
+int main(int argc, char **argv)
+{
+    ExplorerConfig config;
+    if (!parseArgs(argc, argv, config))
+        return 1;
+
+    KeyGenerator gen(config.dist, config.num_keys);
+    std::vector<u64> keys(config.num_keys);
+    for (auto &k : keys)
+        k = gen.next();
+    std::vector<u64> sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+
+    // 所有参数组合使用同一组查询; 预先算好精确结果
+    std::vector<std::pair<u64, u64>> queries;
+    for (u64 range_len : config.range_lens)
+        for (u64 i = 0; i < config.num_queries; ++i)
+            queries.push_back(makeRange(gen.nextQuery(), range_len));
+    std::vector<bool> truth(queries.size());
+    u64 empty = 0;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        truth[i] = oracle(sorted, queries[i].first, queries[i].second);
+        empty += !truth[i];
+    }
+    fprintf(stderr, "%s keys: %lu, queries: %zu (%lu empty)\n", distributionName(config.dist),
+            config.num_keys, queries.size(), empty);
+
+    printf("total_size,alpha,beta,false_positive,bits_per_key,fpr,ns_per_query\n");
+    std::vector<Point> points;
+    for (double bits : config.bits_per_key)
+        for (double alpha_value : config.alphas)
+            for (double beta : config.betas)
+                for (double fp : config.false_positives)
+                {
+                    u32 alpha = u32(alpha_value);
+                    if (alpha == 0 || 64 % alpha != 0)
+                    {
+                        fprintf(stderr, "skip alpha %u: must divide 64\n", alpha);
+                        continue;
+                    }
+                    u64 total_size = u64(bits * config.num_keys / 8);
+                    if (total_size > UINT32_MAX)
+                    {
+                        fprintf(stderr, "skip %g bits/key: total_size exceeds u32\n", bits);
+                        continue;
+                    }
+                    Rosetta<u64> rose(total_size, alpha, beta, fp);
+                    for (auto k : keys)
+                        rose.insertKey(k);
+
+                    std::vector<bool> answers(queries.size());
+                    u64 start = getNowNs();
+                    for (size_t i = 0; i < queries.size(); ++i)
+                        answers[i] = rose.range_query(queries[i].first, queries[i].second);
+                    u64 elapsed = getNowNs() - start;
+
+                    u64 false_positives = 0;
+                    for (size_t i = 0; i < queries.size(); ++i)
+                    {
+                        if (truth[i] && !answers[i])
+                        {
+                            fprintf(stderr, "FALSE NEGATIVE: [%lu, %lu] total_size %lu alpha %u beta %g fp %g\n",
+                                    queries[i].first, queries[i].second, total_size, alpha, beta, fp);
+                            return 2;
+                        }
+                        false_positives += !truth[i] && answers[i];
+                    }
+
+                    Point p;
+                    p.total_size = total_size;
+                    p.alpha = alpha;
+                    p.beta = beta;
+                    p.false_positive = fp;
+                    p.bits_per_key = rose.getMemoryUsage() * 8.0 / config.num_keys;
+                    p.fpr = empty ? double(false_positives) / empty : 0;
+                    p.ns_per_query = double(elapsed) / queries.size();
+                    points.push_back(p);
+                    printPoint(p);
+                    fflush(stdout);
+                }
+
+    std::vector<Point> frontier;
+    for (auto &p : points)
+    {
+        bool dominated = false;
+        for (auto &q : points)
+            if (dominates(q, p))
+            {
+                dominated = true;
+                break;
+            }
+        if (!dominated)
+            frontier.push_back(p);
+    }
+    std::sort(frontier.begin(), frontier.end(),
+              [](const Point &a, const Point &b) { return a.bits_per_key < b.bits_per_key; });
+    printf("\n# pareto frontier (bits_per_key, fpr, ns_per_query)\n");
+    printf("total_size,alpha,beta,false_positive,bits_per_key,fpr,ns_per_query\n");
+    for (auto &p : frontier)
+        printPoint(p);
+    return 0;
+}
@@ -0,0 +1,158 @@
+// wide_range_test 按探测次数检查展开是否有界
+#ifndef ROSETTA_STATS
+#define ROSETTA_STATS
+#endif
+
+#include <memory>
+#include <random>
+
+#include "MemoryGovernor.hpp"
+
+using namespace elastic_rose;
+
+// 检查所有已插入的键在点查询与包含它的范围查询上都不会出现假阴性
+static size_t false_negatives(Rosetta<u64> &rose, const std::vector<u64> &keys)
+{
+    size_t fn = 0;
+    for (auto key : keys)
+    {
+        if (!rose.lookupKey(key))
+            fn++;
+        if (!rose.range_query(key > 100 ? key - 100 : 0, key + 100))
+            fn++;
+    }
+    return fn;
+}
+
+// 丢弃大部分层之后, 宽的空范围查询仍不能逐层展开丢弃层的子节点
+static void wide_range_test()
+{
+    std::mt19937_64 rng(2);
+    // 快照模式下每层各占单独的页, 收缩可以停在丢弃了 11 层的状态
+    RosettaOptions options;
+    options.snapshots = true;
+    Rosetta<u64> rose(256 * 1024, 4, 0.5, 0.01, options);
+    for (int i = 0; i < 200; ++i)
+        rose.insertKey(rng() | (u64(1) << 63));
+    while (rose.getDroppedLevels() < 11 && rose.shrink() > 0)
+        ;
+    rose.resetStats();
+    size_t hits = 0, queries = 0;
+    for (u32 bits = 16; bits <= 60; bits += 4, ++queries)
+        hits += rose.range_query(0, u64(1) << bits);
+    u64 probes = 0;
+    for (u64 p : rose.getStats().probes)
+        probes += p;
+    printf("wide empty ranges with %u dropped levels: %zu maybe, %lu probes\n", rose.getDroppedLevels(), hits,
+           probes);
+    // 每个查询至多展开一层丢弃层的子节点, 探测次数与层数 x 2^alpha 同阶, 而不是随丢弃层数指数增长
+    assert(rose.getDroppedLevels() == 11 && probes <= (queries * rose.getLevels() << rose.getAlpha()));
+}
+
+// /proc/self/status 中的 RssAnon: 进程实际驻留的匿名内存字节数
+static u64 resident_anon_bytes()
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    u64 kb = 0;
+    while (f != nullptr && fgets(line, sizeof(line), f))
+        if (sscanf(line, "RssAnon: %lu kB", &kb) == 1)
+            break;
+    if (f != nullptr)
+        fclose(f);
+    return kb * 1024;
+}
+
+// 上千个小于一页的层组成的小过滤器: 预算收紧后进程驻留内存的减少量与报告释放的字节数一致
+static void resident_test()
+{
+    const int kFilters = 1000;
+    std::mt19937_64 rng(3);
+    std::vector<std::unique_ptr<Rosetta<u64>>> filters;
+    for (int i = 0; i < kFilters; ++i)
+    {
+        filters.emplace_back(new Rosetta<u64>(64 * 1024, 4, 0.5, 0.01));
+        for (int j = 0; j < 500; ++j)
+            filters.back()->insertKey(rng());
+    }
+    MemoryGovernor governor(~0ULL);
+    for (int i = 0; i < kFilters; ++i)
+        governor.track(filters[i].get(), i % 4);
+    const u64 usage = governor.getMemoryUsage();
+    const u64 rss = resident_anon_bytes();
+    for (u64 budget : {usage / 8, usage / 32})
+    {
+        governor.setBudget(budget);
+        const u64 freed = usage - governor.getMemoryUsage();
+        const u64 now = resident_anon_bytes();
+        const u64 rss_freed = rss > now ? rss - now : 0;
+        printf("%d small filters, budget %8lu: usage %8lu, freed %8lu, resident freed %8lu\n", kFilters, budget,
+               governor.getMemoryUsage(), freed, rss_freed);
+        assert(governor.getMemoryUsage() <= budget);
+        // 允许 5% 的误差 (从未写过的页与堆上的元数据)
+        assert(rss_freed >= freed - freed / 20);
+    }
+    for (auto &filter : filters)
+        governor.untrack(filter.get());
+}
+
+int main()
+{
+    const int kFilters = 8;
+    const u32 kFilterSize = 256 * 1024;
+    std::mt19937_64 rng(1);
+    std::vector<Rosetta<u64> *> filters;
+    std::vector<std::vector<u64>> keys(kFilters);
+    u64 total = 0;
+    for (int i = 0; i < kFilters; ++i)
+    {
+        filters.push_back(new Rosetta<u64>(kFilterSize, 4, 0.5, 0.01));
+        for (int j = 0; j < 2000; ++j)
+        {
+            keys[i].push_back(rng());
+            filters[i]->insertKey(keys[i].back());
+        }
+        total += filters[i]->getMemoryUsage();
+    }
+
+    MemoryGovernor governor(total);
+    for (int i = 0; i < kFilters; ++i)
+        governor.track(filters[i], i);
+    printf("registered %d filters, usage %lu bytes\n", kFilters, governor.getMemoryUsage());
+    assert(governor.getMemoryUsage() == total);
+
+    for (u64 budget : {total / 2, total / 8, total / 64, u64(0)})
+    {
+        governor.setBudget(budget);
+        size_t fn = 0;
+        u32 dropped = 0;
+        for (int i = 0; i < kFilters; ++i)
+        {
+            fn += false_negatives(*filters[i], keys[i]);
+            dropped += filters[i]->getDroppedLevels();
+        }
+        printf("budget %9lu: usage %9lu, lowest priority %7lu, highest priority %7lu, "
+               "dropped levels %u, false negatives %zu\n",
+               budget, governor.getMemoryUsage(), filters[0]->getMemoryUsage(),
+               filters[kFilters - 1]->getMemoryUsage(), dropped, fn);
+        assert(governor.getMemoryUsage() <= budget);
+        assert(fn == 0);
+        // 只要还能折半就不丢弃任何实例的层
+        assert(budget == 0 || dropped == 0);
+    }
+
+    // 所有层都被丢弃后, 查询保守地返回"可能存在"
+    assert(filters[0]->lookupKey(12345));
+    assert(filters[0]->range_query(10, 20));
+
+    for (int i = 0; i < kFilters; ++i)
+    {
+        governor.untrack(filters[i]);
+        delete filters[i];
+    }
+    assert(governor.getMemoryUsage() == 0);
+    wide_range_test();
+    resident_test();
+    printf("All tests completed.\n");
+    return 0;
+}
@@ -0,0 +1,105 @@
+// 比较普通哈希与前缀局部哈希 (RosettaOptions::prefix_local_hashing) 下的
+// 范围查询假阳性率与查询耗时. 真实结果由有序键数组给出.
+// 用法: prefix_local_bench [total_mb] [num_keys] [num_queries]
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "rosetta.hpp"
+
+using namespace elastic_rose;
+
+struct Result
+{
+    u64 empty = 0;
+    u64 false_positive = 0;
+    u64 false_negative = 0;
+    double ns = 0;
+};
+
+static bool oracle(const std::vector<u64> &sorted, u64 low, u64 high)
+{
+    auto it = std::lower_bound(sorted.begin(), sorted.end(), low);
+    return it != sorted.end() && *it <= high;
+}
+
+static Result measure(Rosetta<u64> &rose, const std::vector<u64> &sorted,
+                      const std::vector<std::pair<u64, u64>> &queries)
+{
+    Result r;
+    std::vector<bool> answers(queries.size());
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); ++i)
+        answers[i] = rose.range_query(queries[i].first, queries[i].second);
+    auto end = std::chrono::steady_clock::now();
+    r.ns = std::chrono::duration<double, std::nano>(end - start).count() / queries.size();
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        bool truth = oracle(sorted, queries[i].first, queries[i].second);
+        if (!truth)
+        {
+            r.empty++;
+            if (answers[i])
+                r.false_positive++;
+        }
+        else if (!answers[i])
+        {
+            r.false_negative++;
+        }
+    }
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    u64 total_mb = argc > 1 ? strtoull(argv[1], nullptr, 10) : 16;
+    u64 num_keys = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000;
+    u64 num_queries = argc > 3 ? strtoull(argv[3], nullptr, 10) : 200000;
+    // 构造参数 total_size 为 u32
+    if (total_mb == 0 || total_mb * 1024 * 1024 > UINT32_MAX)
+    {
+        fprintf(stderr, "total_mb must be between 1 and %lu\n", u64(UINT32_MAX) / (1024 * 1024));
+        return 1;
+    }
+    u32 total_size = total_mb * 1024 * 1024;
+
+    std::mt19937_64 rng(7);
+    std::vector<u64> keys(num_keys);
+    for (auto &k : keys)
+        k = rng();
+    std::vector<u64> sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+
+    RosettaOptions local;
+    local.prefix_local_hashing = true;
+    Rosetta<u64> plain_rose(total_size, 4, 0.5, 0.01);
+    Rosetta<u64> local_rose(total_size, 4, 0.5, 0.01, local);
+    for (auto k : keys)
+    {
+        plain_rose.insertKey(k);
+        local_rose.insertKey(k);
+    }
+
+    printf("filter %lu MB, %lu keys, %.1f bits/key\n", total_mb, num_keys,
+           total_size * 8.0 / num_keys);
+    printf("%-10s %-8s %10s %10s %8s %10s\n", "range", "hashing", "empty", "fpr", "fn", "ns/query");
+    for (u64 range_len : {u64(1), u64(16), u64(1) << 10, u64(1) << 20, u64(1) << 30})
+    {
+        std::vector<std::pair<u64, u64>> queries(num_queries);
+        for (auto &q : queries)
+        {
+            u64 low = rng();
+            u64 high = low + range_len - 1 < low ? UINT64_MAX : low + range_len - 1;
+            q = {low, high};
+        }
+        Result plain = measure(plain_rose, sorted, queries);
+        Result prefix_local = measure(local_rose, sorted, queries);
+        printf("%-10lu %-8s %10lu %10.5f %8lu %10.1f\n", range_len, "plain", plain.empty,
+               double(plain.false_positive) / plain.empty, plain.false_negative, plain.ns);
+        printf("%-10lu %-8s %10lu %10.5f %8lu %10.1f\n", range_len, "local", prefix_local.empty,
+               double(prefix_local.false_positive) / prefix_local.empty,
+               prefix_local.false_negative, prefix_local.ns);
+    }
+    return 0;
+}
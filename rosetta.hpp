@@ -1,20 +1,72 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <bitset>
 #include <assert.h>
+#include <climits>
+#include <atomic>
 #include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
 
+#include "CounterCodec.hpp"
 #include "CountingBloomFilter.hpp"
+#include "EmptyPrefixStash.hpp"
+#include "LevelArena.hpp"
+#include "RosettaStats.hpp"
+#include "ThreadPool.hpp"
 #include "configuration.hpp"
 
 namespace elastic_rose
 {
+    // Rosetta 构造时的可选项
+    struct RosettaOptions
+    {
+        // 所有层的存储尝试使用 2MB 大页 (MAP_HUGETLB, 失败时退回 madvise)
+        bool huge_pages = false;
+        // 第 1 层及以下使用前缀局部哈希: 同一父前缀的 2^alpha 个子前缀落在同一个 cache line,
+        // doubt 扫描全部子节点时只访问一到两个 cache line, 宽范围查询快 2-4 倍. 代价是明显更高的假阳性率,
+        // 且每键位数越多相对代价越大. prefix_local_bench (1M 随机键) 实测 plain → local:
+        //   16MB: 点查询 0.017 → 0.030, 长 1024 的范围 0.68 → 0.79
+        //   32MB: 点查询 0.0018 → 0.0069, 长 1024 的范围 0.019 → 0.096
+        bool prefix_local_hashing = false;
+        // 支持 snapshot(): 计数器按 4KB 分页、每页单独分配并写时复制, insertKey / DeleteKey / shrink 串行化.
+        // 与写入并发的查询只能在快照上进行. 开启时 huge_pages 不起作用; 关闭时不分页也不加锁
+        bool snapshots = false;
+        // 写合并缓冲区可容纳的不同键数, 0 表示关闭. 开启后 insertKey / DeleteKey 只累加每个键的
+        // 净增量 (插入后又删除的键直接抵消), 达到上限或调用 flush() 时按计数器地址排序后批量写入各层.
+        // 查询会先检查缓冲区中待插入的键; 有写入时查询不能与之并发 (快照模式下请在快照上查询)
+        size_t write_buffer_keys = 0;
+        // 精确模式的字节上限, 0 表示关闭. 开启后键先按序存放在数组中, 不分配各层, 查询用二分查找,
+        // 没有假阳性; 数组超过该字节数时按构造参数分配各层, 把已有的键全部插入后转为普通模式.
+        // 精确模式下不使用写合并缓冲区, 也不能收缩; 有写入时查询不能与之并发
+        size_t exact_bytes = 0;
+        // markEmpty 最多记住的空前缀数, 0 表示关闭
+        size_t empty_stash_entries = 0;
+    };
+
+    // 构造参数 total_size 为 u32, 各层取整后的总字节数不超过 total_size (过小时以每层的最小值为准);
+    // 也是 decode 默认接受的上限
+    const u64 kRosettaMaxLevelBytes = UINT32_MAX;
+
+    // Rosetta::shrink 一步允许的收缩方式, 对假阳性率的影响依次增大
+    enum class ShrinkMode
+    {
+        kFreeFold, // 只折半插入数不超过折半后容量的层
+        kFold,     // 可以折半任意层
+        kDrop,     // 无法再折半时丢弃层
+    };
+
+    // Key 为 u32 / u64 / u128, 层数、掩码与哈希都随键宽度变化
+    template <typename Key = u64>
     class Rosetta
     {
     public:
+        using key_type = Key;
 
         std::vector<u64> allocateSpace(double total_size, double beta, int n) {
             std::vector<u64> layers(n);
@@ -37,67 +89,244 @@ namespace elastic_rose
         }
 
         Rosetta(){};
-        // 默认alpha能被64整除, beta < 1, p是预期的假阳性率
-        Rosetta(u32 total_size, u32 alpha, double beta, double false_positive)
-         : alpha_(alpha), beta_(beta), expected_false_positive_(false_positive)
+        // 默认alpha能被键宽度整除, beta < 1, p是预期的假阳性率
+        Rosetta(u32 total_size, u32 alpha, double beta, double false_positive,
+                const RosettaOptions &options = RosettaOptions())
+         : alpha_(alpha), beta_(beta), expected_false_positive_(false_positive), options_(options),
+           total_size_(total_size)
         {
             
-            levels_ = 64 / alpha;
-            // std::cout << "levels:" << levels_ << std::endl;
-            bfs = std::vector<CountingBloomFilter *>(levels_);
-            auto alloc = allocateSpace(total_size, beta, levels_);
-            // double pre_time1, pre_time2, pre_time = 0, build_time = 0;
-            for (int i = levels_ - 1; i >= 0; --i)
+            levels_ = KeyTraits<Key>::bits / alpha;
+            if (options_.snapshots)
             {
-                std::cout << "total_size " << alloc[i] << " expected_false_positive_ " << expected_false_positive_ << std::endl;
-                bfs[i] = new CountingBloomFilter(alloc[i], expected_false_positive_, i);
+                write_mutex_.reset(new std::mutex);
+                page_bytes_ = std::make_shared<std::atomic<u64>>(0);
             }
-
-            // std::cout << "pre_time:" << pre_time << std::endl;
-            // std::cout << "bloom_build_time:" << build_time << std::endl;
+#ifdef ROSETTA_STATS
+            level_stats_.resize(levels_);
+            depth_histogram_.resize(levels_);
+#endif
+            // 精确模式推迟到数组超过上限时再分配各层
+            exact_ = options_.exact_bytes > 0;
+            if (!exact_)
+                allocateLevels();
         }
-        ~Rosetta()
+
+        Rosetta(Rosetta &&) = default;
+        Rosetta &operator=(Rosetta &&) = default;
+
+        // 当前版本的只读视图, 需要 RosettaOptions::snapshots. 快照与本过滤器共享计数器页,
+        // 之后的写入只复制被修改且仍被快照引用的页, 因此快照上的查询始终看到完整的一个版本.
+        // 旧页在最后一个引用它的快照释放时随之释放. 直接在本对象上的查询不受保护: 写入与收缩会
+        // 原地替换、截短页表 (OwnPageTable / Fold), 与之并发的查询可能访问已释放的内存, 必须由调用者
+        // 与写入互斥 (与写合并缓冲区的要求相同); 需要与写入并发的读者请在快照上查询.
+        // 未开启 snapshots 时返回 nullptr
+        std::shared_ptr<const Rosetta> snapshot() const
         {
-            for (auto bf : bfs)
-                delete bf;
+            if (write_mutex_ == nullptr)
+                return nullptr;
+            std::lock_guard<std::mutex> guard(*write_mutex_);
+            return std::shared_ptr<const Rosetta>(new Rosetta(*this));
         }
 
-        bool lookupKey(const u64 &key)
+        bool lookupKey(const Key &key) const
         {
-            return bfs[levels_ - 1]->KeyMayMatch(key);
+            ROSETTA_STAT(point_lookups_.add());
+            if (exact_)
+                return exactMayContain(key, key);
+            if (bufferMayContain(key, key))
+                return true;
+            if (stashCovers(key, levels_ - 1))
+            {
+                ROSETTA_STAT(stash_hits_.add());
+                return false;
+            }
+            return probeLevel(levels_ - 1, key);
         }
 
         // bool lookupKey(const std::string &key);
 
-        void insertKey(u64 key)
+        void insertKey(Key key)
         {
-            u64 base = pow(2, alpha_) - 1;
-            u64 last = 0;
-            for (u32 i = 0; i < levels_; ++i)
+            auto guard = writeLock();
+            if (!stash_.empty())
+                for (u32 l = 0; l < levels_; ++l)
+                    stash_.erase(prefixOf(key, l), l);
+            if (exact_)
             {
-                u64 mask = last + (base << (alpha_ * (levels_ - i - 1)));
-                u64 ik = key & mask;
-                bfs[i]->PutKey(ik);
-                last = mask;
+                const size_t max_keys = options_.exact_bytes / sizeof(Key);
+                if (exact_keys_.size() < max_keys)
+                {
+                    // 自行按倍增扩容并封顶在 max_keys, vector 自身的扩容可能使容量超过 exact_bytes
+                    if (exact_keys_.size() == exact_keys_.capacity())
+                        exact_keys_.reserve(std::min(max_keys, std::max<size_t>(4, exact_keys_.size() * 2)));
+                    exact_keys_.insert(std::upper_bound(exact_keys_.begin(), exact_keys_.end(), key), key);
+                    return;
+                }
+                upgrade();
+            }
+            if (options_.write_buffer_keys > 0)
+            {
+                bufferDelta(key, 1);
+                return;
             }
+            insertLevels(key);
         }
         // void insertKey(std::string key);
 
-        void DeleteKey(u64 key)
+        void DeleteKey(Key key)
         {
-            u64 base = pow(2, alpha_) - 1;
-            u64 last = 0;
+            auto guard = writeLock();
+            if (exact_)
+            {
+                auto it = std::lower_bound(exact_keys_.begin(), exact_keys_.end(), key);
+                if (it != exact_keys_.end() && *it == key)
+                    exact_keys_.erase(it);
+                return;
+            }
+            if (options_.write_buffer_keys > 0)
+            {
+                bufferDelta(key, -1);
+                return;
+            }
+            Key base = (Key(1) << alpha_) - 1;
+            Key last = 0;
             for (u32 i = 0; i < levels_; ++i)
             {
-                u64 mask = last + (base << (alpha_ * (levels_ - i - 1)));
-                u64 ik = key & mask;
-                bfs[i]->DeleteKey(ik);
+                Key mask = last + (base << (alpha_ * (levels_ - i - 1)));
+                Key ik = key & mask;
+                bfs[i].DeleteKey(ik);
                 last = mask;
             }
         }
 
-        bool range_query(u64 low, u64 high);
-        bool range_query(u64 low, u64 high, u64 p, u64 l);
+        bool range_query(Key low, Key high) const;
+        bool range_query(Key low, Key high, Key p, u64 l) const;
+
+        // 范围查询计划的第一步: low 与 high 的公共前缀所在的最深一层, 该层前缀覆盖整个范围,
+        // 不存在时范围必然为空. 前缀写入 anchor; 没有公共的层 (范围跨越第 0 层的子节点) 时返回 -1
+        int rangeAnchor(Key low, Key high, Key &anchor) const
+        {
+            Key diff = low ^ high;
+            u32 shared = diff == 0 ? levels_ : countLeadingZeros(diff) / alpha_;
+            if (shared == 0)
+                return -1;
+            anchor = prefixOf(low, shared - 1);
+            return int(shared - 1);
+        }
+
+        // 第二步: 按键序访问恰好覆盖 [low, high] 的最少前缀集合 (前缀, 层), 各前缀的范围互不相交.
+        // 直接由 low 与 high 的各位算出边界, 不逐个扫描不相交的子节点. visit 返回 true 时停止并返回 true
+        template <class Visit>
+        bool visitCoveringPrefixes(Key low, Key high, Visit &&visit) const;
+
+        // 逐个取覆盖前缀: 以 from 开头且不超过 high 的最大节点所在的层, 该节点的前缀就是 from (from <= high).
+        // 从 low 开始、每次以上一个节点的末尾加一为 from, 按键序得到与 visitCoveringPrefixes 相同的前缀
+        u32 coveringLevel(Key from, Key high) const
+        {
+            for (u32 l = 0; l + 1 < levels_; ++l)
+            {
+                const Key mask = (Key(1) << shiftOf(l)) - 1;
+                if ((from & mask) == 0 && (from | mask) <= high)
+                    return l;
+            }
+            return levels_ - 1;
+        }
+
+        // 把写合并缓冲区中的净增量写入各层
+        void flush()
+        {
+            auto guard = writeLock();
+            flushBuffer();
+        }
+
+        size_t getBufferedKeys() const { return write_buffer_.size(); }
+
+        // 编码为紧凑的传输格式 (计数器的编码见 CounterCodec.hpp), 写合并缓冲区中的增量一并编码.
+        // 有并发写入时请对 snapshot() 编码, 以得到一致的版本
+        void encode(std::vector<u8> &out) const;
+
+        // 解码 encode 的结果. 前缀局部哈希沿用编码时的设置, options 的其余各项由接收方决定.
+        // 各层计数器的总字节数超过 max_bytes (默认为构造参数所能产生的上限)、数据格式错误或
+        // 内存分配失败时返回 false, out 保持不变
+        static bool decode(const u8 *data, size_t size, Rosetta &out,
+                           const RosettaOptions &options = RosettaOptions(),
+                           u64 max_bytes = kRosettaMaxLevelBytes);
+
+        // 缓冲区中是否有 [low, high] 内待插入的键; 待删除的键仍留在各层中, 结果保持保守
+        bool bufferMayContain(Key low, Key high) const
+        {
+            for (auto it = write_buffer_.lower_bound(low); it != write_buffer_.end() && it->first <= high; ++it)
+                if (it->second > 0)
+                    return true;
+            return false;
+        }
+
+        // 调用者读取数据后确认 [low, high] 内没有键时调用: 覆盖该范围、且各层仍判为可能存在的前缀
+        // 记入有界的空前缀表 (RosettaOptions::empty_stash_entries), 之后的查询遇到这些前缀时不再探测.
+        // 插入落在某个记录的前缀之下时该记录失效. 与插入一样不能与查询并发; 空前缀表随快照复制, 不参与编码
+        void markEmpty(Key low, Key high)
+        {
+            auto guard = writeLock();
+            if (exact_ || options_.empty_stash_entries == 0 || low > high || bufferMayContain(low, high))
+                return;
+            if (stash_.capacity() == 0)
+                stash_ = EmptyPrefixStash<Key>(options_.empty_stash_entries);
+            visitCoveringPrefixes(low, high, [this](Key prefix, u32 l) {
+                if (doubt(prefix, prefix, l))
+                    stash_.insert(prefix, l);
+                return false;
+            });
+        }
+
+        // 第 level 层的 prefix 是否记录为空
+        bool isStashed(Key prefix, u32 level) const { return stash_.contains(prefix, level); }
+
+        // key 在第 0 到 level 层的前缀中是否有记录为空的
+        bool stashCovers(Key key, u32 level) const
+        {
+            if (stash_.empty())
+                return false;
+            for (u32 l = 0; l <= level; ++l)
+                if (stash_.contains(prefixOf(key, l), l))
+                    return true;
+            return false;
+        }
+
+        size_t getStashedPrefixes() const { return stash_.size(); }
+
+        // 是否处于精确模式 (RosettaOptions::exact_bytes)
+        bool isExact() const { return exact_; }
+
+        // 精确模式下 [low, high] 内是否有键
+        bool exactMayContain(Key low, Key high) const
+        {
+            auto it = std::lower_bound(exact_keys_.begin(), exact_keys_.end(), low);
+            return it != exact_keys_.end() && *it <= high;
+        }
+
+        // 查询内并行: 估计工作量不低于 work_threshold 的范围查询在锚点探测通过后, 把覆盖前缀
+        // (只有锚点一个时改为锚点的子节点) 分发到 pool 上执行, 任一分支返回 true 后其余分支尽快退出.
+        // pool 为 nullptr 时关闭; pool 的生命周期由调用者保证.
+        void setQueryPool(ThreadPool *pool, u64 work_threshold = 256)
+        {
+            query_pool_ = pool;
+            parallel_work_threshold_ = work_threshold;
+        }
+
+        // 粗略估计范围查询的探测次数, 只看锚点下一层: 范围跨越的子节点数 x 子树深度 x 每层检查的 2^alpha 个节点.
+        // 只做常数次位运算, 设置了 pool 的短查询不必为选择路径先遍历覆盖前缀
+        u64 estimateQueryWork(Key low, Key high) const
+        {
+            if (low > high)
+                return 0;
+            Key diff = low ^ high;
+            u32 s = diff == 0 ? levels_ : countLeadingZeros(diff) / alpha_;
+            if (s >= levels_)
+                return 1;
+            u64 span = digitOf(high, s) - digitOf(low, s) + 1;
+            return (span * (levels_ - s)) << alpha_;
+        }
         // bool range_query(const std::string &low, const std::string &high);
         // bool range_query(const std::string &low, const std::string &high, std::string &p, u64 l, std::string &min_accept);
 
@@ -106,17 +335,452 @@ namespace elastic_rose
         // u64 seek(const u64 &key);
         // std::string seek(const std::string &key);
         u32 getLevels() const { return levels_; }
+        u32 getAlpha() const { return alpha_; }
+        const CountingBloomFilter &getLevel(u32 level) const { return bfs[level]; }
+
+        u64 getMemoryUsage()
+        {
+            if (exact_)
+                return exact_keys_.capacity() * sizeof(Key);
+            return storageBytes() + stash_.getMemoryUsage();
+        }
+
+        // 直接探测第 level 层; 精确模式下检查是否有键以 key 在该层的前缀开头
+        bool levelMayMatch(u32 level, const Key &key) const
+        {
+            if (exact_)
+            {
+                Key prefix = prefixOf(key, level);
+                return exactMayContain(prefix, prefix | ((Key(1) << shiftOf(level)) - 1));
+            }
+            return bfs[level].KeyMayMatch(key);
+        }
+
+        bool usesHugeTlb() const { return arena_ && arena_->hugeTlb(); }
+
+        // 供内存管控使用: 按 mode 允许的方式逐步收缩, 直到至少归还一页, 返回释放的字节数,
+        // 0 表示该方式下已无法再收缩. 收缩顺序: 先折半仍有余量的层, 再继续折半最大的层,
+        // 所有层都无法再折半后从第 0 层开始依次丢弃. 小于一页的层要折半或丢弃多层才能空出一页;
+        // 各层共用的页只有在其上的层全部丢弃后才会归还 (快照模式下每层各占单独的页).
+        // 折半与丢弃都只会增加假阳性, 不会产生假阴性. 调用期间不能有并发的读写 (快照不受影响).
+        u64 shrink(ShrinkMode mode = ShrinkMode::kDrop)
+        {
+            auto guard = writeLock();
+            if (exact_)
+                return 0;
+            const u64 before = storageBytes();
+            // 小于一页的层折半或丢弃后不会空出整页, 继续收缩直到驻留内存真正减少
+            while (shrinkStep(mode))
+            {
+                compact();
+                const u64 after = storageBytes();
+                if (after < before)
+                    return before - after;
+            }
+            return 0;
+        }
+
+        // 内部统计的快照; 未定义 ROSETTA_STATS 时只有 load_factor 有效
+        RosettaStats getStats()
+        {
+            RosettaStats stats;
+            for (auto &bf : bfs)
+                stats.load_factor.push_back(bf.GetExpectNum() ? double(bf.GetInsertNum()) / bf.GetExpectNum() : 0);
+#ifdef ROSETTA_STATS
+            stats.enabled = true;
+            stats.point_lookups = point_lookups_.load();
+            stats.range_queries = range_queries_.load();
+            stats.stash_hits = stash_hits_.load();
+            for (u32 i = 0; i < levels_; ++i)
+            {
+                stats.probes.push_back(level_stats_[i].probes.load());
+                stats.positives.push_back(level_stats_[i].positives.load());
+                stats.saturation_events.push_back(exact_ ? 0 : bfs[i].GetSaturationEvents());
+                stats.capacity_events.push_back(level_stats_[i].capacity_events.load());
+                stats.depth_histogram.push_back(depth_histogram_[i].load());
+            }
+#endif
+            return stats;
+        }
+
+        void resetStats()
+        {
+#ifdef ROSETTA_STATS
+            point_lookups_ = AtomicCounter();
+            range_queries_ = AtomicCounter();
+            stash_hits_ = AtomicCounter();
+            for (u32 i = 0; i < levels_; ++i)
+            {
+                level_stats_[i] = LevelStats();
+                depth_histogram_[i] = AtomicCounter();
+                if (!exact_)
+                    bfs[i].ResetStats();
+            }
+#endif
+        }
+
+        u32 getDroppedLevels() const
+        {
+            u32 n = 0;
+            for (auto &bf : bfs)
+                n += bf.IsDropped();
+            return n;
+        }
 
     private:
-        std::vector<CountingBloomFilter *> bfs;
+        // 快照模式下各层的计数器页引用 arena, arena 在最后一个快照释放后才回收
+        std::shared_ptr<LevelArena> arena_;
+        std::vector<CountingBloomFilter> bfs;
         u32 levels_;
         u32 alpha_;   // 相邻层之间的位差
         double beta_; // 相邻层之间的空间差异
         u64 min_size_ = 1024;
         double expected_false_positive_;
+        RosettaOptions options_;
         u64 R_;
+        std::unique_ptr<std::mutex> write_mutex_; // 仅快照模式下存在
+        std::shared_ptr<std::atomic<u64>> page_bytes_; // 快照模式下所有副本中存活页的字节数
+        std::map<Key, int> write_buffer_;         // 键 -> 尚未写入各层的净插入次数
+        u32 total_size_ = 0;                      // 构造时的总空间, 精确模式转换时按它分配各层
+        bool exact_ = false;
+        std::vector<Key> exact_keys_;             // 精确模式下的键, 有序, 可重复
+        EmptyPrefixStash<Key> stash_;             // markEmpty 记录的空前缀, 第一次调用时分配
+
+        // 仅供 snapshot() 使用: 各层共享计数器页, 不带写锁, 统计从零开始
+        Rosetta(const Rosetta &other)
+            : arena_(other.arena_), bfs(other.bfs), levels_(other.levels_), alpha_(other.alpha_),
+              beta_(other.beta_), min_size_(other.min_size_),
+              expected_false_positive_(other.expected_false_positive_), options_(other.options_),
+              page_bytes_(other.page_bytes_), write_buffer_(other.write_buffer_), total_size_(other.total_size_), exact_(other.exact_),
+              exact_keys_(other.exact_keys_), stash_(other.stash_), query_pool_(other.query_pool_), parallel_work_threshold_(other.parallel_work_threshold_)
+        {
+#ifdef ROSETTA_STATS
+            level_stats_.resize(levels_);
+            depth_histogram_.resize(levels_);
+#endif
+        }
+
+        void insertLevels(Key key)
+        {
+            Key base = (Key(1) << alpha_) - 1;
+            Key last = 0;
+            for (u32 i = 0; i < levels_; ++i)
+            {
+                Key mask = last + (base << (alpha_ * (levels_ - i - 1)));
+                Key ik = key & mask;
+#ifdef ROSETTA_STATS
+                if (!bfs[i].PutKey(ik) && bfs[i].GetInsertNum() > bfs[i].GetExpectNum() * 2)
+                    level_stats_[i].capacity_events.add();
+#else
+                bfs[i].PutKey(ik);
+#endif
+                last = mask;
+            }
+        }
+
+        // 分配各层并把精确模式下的键全部插入, 之后转为普通模式
+        void upgrade()
+        {
+            allocateLevels();
+            for (auto key : exact_keys_)
+                insertLevels(key);
+            std::vector<Key>().swap(exact_keys_);
+            exact_ = false;
+        }
+
+        void bufferDelta(Key key, int delta)
+        {
+            auto it = write_buffer_.emplace(key, 0).first;
+            it->second += delta;
+            if (it->second == 0)
+                write_buffer_.erase(it);
+            else if (write_buffer_.size() >= options_.write_buffer_keys)
+                flushBuffer();
+        }
+
+        // 缓冲区按键有序, 同一前缀的键相邻: 从最后一层开始, 每层把下一层的前缀合并成本层的前缀,
+        // 再把各前缀的计数器位置交给 ApplyDeltas 按所在页排序后写入
+        void flushBuffer()
+        {
+            if (write_buffer_.empty())
+                return;
+            std::vector<std::pair<Key, long>> prefixes(write_buffer_.begin(), write_buffer_.end());
+            std::vector<std::pair<u32, int>> deltas;
+            u32 pos[CountingBloomFilter::kMaxProbes];
+            for (u32 i = levels_; i-- > 0;)
+            {
+                Key mask = ~Key(0) << (alpha_ * (levels_ - i - 1));
+                size_t n = 0;
+                for (size_t j = 0; j < prefixes.size(); ++j)
+                {
+                    Key prefix = prefixes[j].first & mask;
+                    if (n > 0 && prefixes[n - 1].first == prefix)
+                        prefixes[n - 1].second += prefixes[j].second;
+                    else
+                        prefixes[n++] = {prefix, prefixes[j].second};
+                }
+                prefixes.resize(n);
+                if (bfs[i].IsDropped())
+                    continue;
+                deltas.clear();
+                long keys = 0;
+                for (auto &prefix : prefixes)
+                {
+                    if (prefix.second == 0)
+                        continue;
+                    keys += prefix.second;
+                    bfs[i].Locate(prefix.first, pos);
+                    for (size_t j = 0; j < bfs[i].GetNumProbes(); ++j)
+                        deltas.push_back({pos[j], int(prefix.second)});
+                }
+#ifdef ROSETTA_STATS
+                if (!bfs[i].ApplyDeltas(deltas, keys) && bfs[i].GetInsertNum() > bfs[i].GetExpectNum() * 2)
+                    level_stats_[i].capacity_events.add();
+#else
+                bfs[i].ApplyDeltas(deltas, keys);
+#endif
+            }
+            write_buffer_.clear();
+        }
+
+        u64 shiftOf(u32 l) const
+        {
+            return u64(levels_ - l - 1) * alpha_;
+        }
+
+        // key 在第 l 层的前缀 (低位清零)
+        Key prefixOf(Key key, u32 l) const
+        {
+            return key >> shiftOf(l) << shiftOf(l);
+        }
+
+        // key 在第 l 层的那一位 alpha 位的数字
+        u64 digitOf(Key key, u32 l) const
+        {
+            return u64(key >> shiftOf(l)) & ((u64(1) << alpha_) - 1);
+        }
+
+        // 从第 l 层开始, key 以下的各位都等于 fill (0 或全 1) 的最浅层
+        u32 alignedLevel(Key key, u32 l, Key fill) const
+        {
+            while (l + 1 < levels_ && (key & ((Key(1) << shiftOf(l)) - 1)) != (fill & ((Key(1) << shiftOf(l)) - 1)))
+                ++l;
+            return l;
+        }
+
+        // 按构造参数分配各层
+        void allocateLevels()
+        {
+            auto alloc = allocateSpace(total_size_, beta_, levels_);
+            // 向下取整后每层都能被 shrink 多次折半 (前缀局部模式同时满足按块对齐)
+            for (auto &size : alloc)
+                size = foldableSize(size);
+            // 每层的最小值可能使总量超出 total_size, 超出的部分从最大的层扣除
+            u64 sum = 0;
+            for (auto size : alloc)
+                sum += size;
+            auto largest = std::max_element(alloc.begin(), alloc.end());
+            if (sum > total_size_ && *largest > sum - total_size_ + min_size_)
+                *largest = foldableSize(*largest - (sum - total_size_));
+            // 所有层放在同一块 arena 中, 每层起始地址按 cache line 对齐
+            std::vector<u64> offsets(levels_);
+            u64 arena_size = 0;
+            for (u32 i = 0; i < levels_; ++i)
+            {
+                offsets[i] = arena_size;
+                arena_size += roundUp(alloc[i], kCacheLineSize);
+            }
+            arena_ = std::make_shared<LevelArena>(arena_size, options_.huge_pages);
+            bfs.reserve(levels_);
+            // double pre_time1, pre_time2, pre_time = 0, build_time = 0;
+            for (u32 i = 0; i < levels_; ++i)
+            {
+#ifdef ROSETTA_VERBOSE
+                std::cout << "total_size " << alloc[i] << " expected_false_positive_ " << expected_false_positive_ << std::endl;
+#endif
+                bfs.emplace_back(arena_->data() + offsets[i], alloc[i], expected_false_positive_, i);
+                // 第 0 层只有 2^alpha 个前缀且共用同一个(空)父前缀, 仍使用普通哈希
+                if (options_.prefix_local_hashing && i > 0)
+                    bfs[i].SetPrefixLocal(alpha_ * (levels_ - i - 1), alpha_);
+                if (options_.snapshots)
+                    bfs[i].EnableSharing(page_bytes_);
+            }
+            // 快照模式下各层已复制到单独的页中
+            if (options_.snapshots)
+                arena_.reset();
+
+            // std::cout << "pre_time:" << pre_time << std::endl;
+            // std::cout << "bloom_build_time:" << build_time << std::endl;
+        }
+
+        std::unique_lock<std::mutex> writeLock()
+        {
+            if (write_mutex_ == nullptr)
+                return std::unique_lock<std::mutex>();
+            return std::unique_lock<std::mutex>(*write_mutex_);
+        }
+
+        bool shrinkStep(ShrinkMode mode)
+        {
+            int victim = -1;
+            // 1. 折半后插入数仍不超过预期容量的层, 选最大的
+            for (u32 i = 0; i < levels_; ++i)
+                if (bfs[i].CanFold() && bfs[i].GetInsertNum() * 2 <= bfs[i].GetExpectNum() &&
+                    (victim < 0 || bfs[i].getMemoryUsage() > bfs[victim].getMemoryUsage()))
+                    victim = i;
+            if (victim < 0 && mode != ShrinkMode::kFreeFold)
+            {
+                // 2. 继续折半最大的层, 假阳性率随之上升
+                for (u32 i = 0; i < levels_; ++i)
+                    if (bfs[i].CanFold() &&
+                        (victim < 0 || bfs[i].getMemoryUsage() > bfs[victim].getMemoryUsage()))
+                        victim = i;
+            }
+            if (victim >= 0)
+            {
+                const u8 *data = bfs[victim].data();
+                const u64 size = bfs[victim].getMemoryUsage();
+                bfs[victim].Fold();
+                reclaim(data, size, bfs[victim].getMemoryUsage());
+                return true;
+            }
+            if (mode != ShrinkMode::kDrop)
+                return false;
+            // 3. 从第 0 层开始依次丢弃, 此后 doubt 只在最深的丢弃层向下展开一层 (见 doubt)
+            for (u32 i = 0; i < levels_; ++i)
+                if (!bfs[i].IsDropped())
+                {
+                    const u8 *data = bfs[i].data();
+                    const u64 size = bfs[i].getMemoryUsage();
+                    bfs[i].Drop();
+                    reclaim(data, size, 0);
+                    return true;
+                }
+            return false;
+        }
+
+        // 归还某层收缩后空出的 [data + kept, data + size) 中的整页. 快照模式下被截掉的页在
+        // 最后一个引用释放时自行归还; 不足一页的部分由 compact 处理
+        void reclaim(const u8 *data, u64 size, u64 kept)
+        {
+            if (options_.snapshots)
+                return;
+            arena_->discard(const_cast<u8 *>(data) + kept, size - kept);
+        }
+
+        // 各层紧凑排布后能少占页时重新排布 arena (hugetlbfs 页无法部分归还, 只能这样收缩)
+        void compact()
+        {
+            if (options_.snapshots || !arena_)
+                return;
+            if (roundUp(packedBytes(), arena_->pageSize()) < levelBytes())
+                relayout();
+        }
+
+        // 计数器实际驻留的字节数; 快照模式下包括只被快照引用的旧页
+        u64 storageBytes() const
+        {
+            return page_bytes_ ? page_bytes_->load(std::memory_order_relaxed) : levelBytes();
+        }
+
+        // 向下取整到 2^n 个 cache line 的整数倍, 减少不到 1/64, 使该层可以反复折半
+        static u64 foldableSize(u64 size)
+        {
+            u64 unit = kCacheLineSize;
+            while (unit * 64 <= size)
+                unit <<= 1;
+            return std::max<u64>(size / unit * unit, kCacheLineSize);
+        }
+
+        // 各层按 cache line 对齐紧凑排布所需的字节数
+        u64 packedBytes() const
+        {
+            u64 total = 0;
+            for (auto &bf : bfs)
+                total += roundUp(bf.getMemoryUsage(), kCacheLineSize);
+            return total;
+        }
+
+        // 各层计数器驻留的字节数: 按页计算, 只用了一部分或与相邻层共用的页也整页计入,
+        // 折半或丢弃后已归还的页不再计入, 与进程实际占用的内存一致
+        u64 levelBytes() const
+        {
+            if (!arena_)
+                return packedBytes();
+            const u64 page = arena_->pageSize();
+            u64 total = 0, covered = 0; // covered: 已计入的最后一页的末尾地址, 各层按地址递增排列
+            for (auto &bf : bfs)
+            {
+                if (bf.getMemoryUsage() == 0)
+                    continue;
+                u64 begin = std::max<u64>(u64(bf.data()) / page * page, covered);
+                u64 end = roundUp(u64(bf.data()) + bf.getMemoryUsage(), page);
+                if (end > begin)
+                    total += end - begin;
+                covered = std::max(covered, end);
+            }
+            return total;
+        }
+
+        // 按各层当前大小重新分配 arena, 把计数器拷贝过去
+        void relayout()
+        {
+            const u64 arena_size = packedBytes();
+            auto arena = std::make_shared<LevelArena>(arena_size, options_.huge_pages);
+            u64 offset = 0;
+            for (auto &bf : bfs)
+            {
+                if (bf.IsDropped())
+                    continue;
+                bf.Relocate(arena->data() + offset);
+                offset += roundUp(bf.getMemoryUsage(), kCacheLineSize);
+            }
+            arena_ = std::move(arena);
+        }
 
-        bool doubt(u64 cur, u64 next, u64 l);
+#ifdef ROSETTA_STATS
+        struct LevelStats
+        {
+            AtomicCounter probes;
+            AtomicCounter positives;
+            AtomicCounter capacity_events;
+        };
+        mutable std::vector<LevelStats> level_stats_;
+        mutable std::vector<AtomicCounter> depth_histogram_;
+        mutable AtomicCounter point_lookups_;
+        mutable AtomicCounter range_queries_;
+        mutable AtomicCounter stash_hits_;
+
+        // 当前线程上正在执行的范围查询探测到的最深层号
+        static u32 &queryDepth()
+        {
+            thread_local u32 depth = 0;
+            return depth;
+        }
+#endif
+
+        bool probeLevel(u64 l, const Key &key) const
+        {
+            bool hit = bfs[l].KeyMayMatch(key);
+#ifdef ROSETTA_STATS
+            level_stats_[l].probes.add();
+            if (hit)
+                level_stats_[l].positives.add();
+            if (l > queryDepth())
+                queryDepth() = l;
+#endif
+            return hit;
+        }
+
+        ThreadPool *query_pool_ = nullptr;
+        u64 parallel_work_threshold_ = 0;
+
+        // cancel 非空且已被置位时立即返回 false, 供并行查询取消其余分支
+        bool range_query(Key low, Key high, Key p, u64 l, const std::atomic<bool> *cancel) const;
+        // 锚点 (若有) 已经探测通过
+        bool parallel_range_query(Key low, Key high, Key anchor, int anchor_level) const;
+        // probed 为 true 表示第 l 层的 cur 已经探测过 (范围查询的锚点), 直接检查子节点
+        bool doubt(Key cur, Key next, u64 l, const std::atomic<bool> *cancel = nullptr, bool probed = false) const;
         bool doubt(std::string &p, u64 l, std::string &min_accept);
 
         std::string str2BitArray(const std::string &str)
@@ -178,50 +842,397 @@ namespace elastic_rose
     //     return range_query(low, high, p, 1, tmp);
     // }
 
-    inline bool Rosetta::range_query(u64 low, u64 high)
+    // 传输格式: 头部 (magic, 版本, 键宽度, alpha, 标志, beta, 假阳性率, 层数), 每层的描述与计数器编码,
+    // 最后是写合并缓冲区中的 (键, 净增量). 精确模式 (标志第 1 位) 在头部之后只有总空间和有序的键.
+    // 整数为小端序或 varint
+    const u32 kRosettaWireMagic = 0x45534f52; // "ROSE"
+    const u8 kRosettaWireVersion = 1;
+
+    template <typename Key>
+    void Rosetta<Key>::encode(std::vector<u8> &out) const
+    {
+        auto put = [&out](const void *p, size_t n) {
+            out.insert(out.end(), (const u8 *)p, (const u8 *)p + n);
+        };
+        put(&kRosettaWireMagic, 4);
+        out.push_back(kRosettaWireVersion);
+        out.push_back(u8(KeyTraits<Key>::bits));
+        out.push_back(u8(alpha_));
+        out.push_back((options_.prefix_local_hashing ? 1 : 0) | (exact_ ? 2 : 0));
+        put(&beta_, 8);
+        put(&expected_false_positive_, 8);
+        CounterCodec::putVarint(out, levels_);
+        if (exact_)
+        {
+            CounterCodec::putVarint(out, total_size_);
+            CounterCodec::putVarint(out, exact_keys_.size());
+            for (auto key : exact_keys_)
+                put(&key, sizeof(Key));
+            return;
+        }
+        std::vector<u8> counters, payload;
+        for (auto &bf : bfs)
+        {
+            out.push_back(bf.IsDropped() ? 1 : 0);
+            CounterCodec::putVarint(out, bf.GetNumProbes());
+            CounterCodec::putVarint(out, bf.GetExpectNum());
+            CounterCodec::putVarint(out, bf.GetInsertNum());
+            if (bf.IsDropped())
+                continue;
+            const u8 *data = bf.data();
+            if (data == nullptr)
+            {
+                counters.resize(bf.getMemoryUsage());
+                bf.CopyCounters(counters.data());
+                data = counters.data();
+            }
+            payload.clear();
+            CounterCodec::encode(data, bf.getMemoryUsage(), payload);
+            CounterCodec::putVarint(out, bf.getMemoryUsage());
+            CounterCodec::putVarint(out, payload.size());
+            out.insert(out.end(), payload.begin(), payload.end());
+        }
+        CounterCodec::putVarint(out, write_buffer_.size());
+        for (auto &entry : write_buffer_)
+        {
+            put(&entry.first, sizeof(Key));
+            // zigzag
+            CounterCodec::putVarint(out, entry.second < 0 ? (u64(-(long)entry.second) << 1) - 1 : u64(entry.second) << 1);
+        }
+    }
+
+    template <typename Key>
+    bool Rosetta<Key>::decode(const u8 *data, size_t size, Rosetta &out, const RosettaOptions &options,
+                              u64 max_bytes)
+    {
+        const u8 *in = data, *end = data + size;
+        auto get = [&in, end](void *p, size_t n) {
+            if (size_t(end - in) < n)
+                return false;
+            memcpy(p, in, n);
+            in += n;
+            return true;
+        };
+        u32 magic;
+        u8 head[4];
+        Rosetta rose;
+        u64 levels;
+        if (!get(&magic, 4) || magic != kRosettaWireMagic || !get(head, 4) || head[0] != kRosettaWireVersion ||
+            head[1] != KeyTraits<Key>::bits || head[2] == 0 || KeyTraits<Key>::bits % head[2] != 0 ||
+            !get(&rose.beta_, 8) || !get(&rose.expected_false_positive_, 8) ||
+            !CounterCodec::getVarint(in, end, levels) || levels != KeyTraits<Key>::bits / head[2])
+            return false;
+        rose.alpha_ = head[2];
+        rose.levels_ = levels;
+        rose.options_ = options;
+        rose.options_.prefix_local_hashing = head[3] & 1;
+#ifdef ROSETTA_STATS
+        rose.level_stats_.resize(levels);
+        rose.depth_histogram_.resize(levels);
+#endif
+        if (options.snapshots)
+        {
+            rose.write_mutex_.reset(new std::mutex);
+            rose.page_bytes_ = std::make_shared<std::atomic<u64>>(0);
+        }
+
+        // 精确模式保持为精确模式, 之后的插入按接收方的 exact_bytes 决定何时转换
+        if (head[3] & 2)
+        {
+            u64 total_size, count;
+            if (!CounterCodec::getVarint(in, end, total_size) || total_size > UINT32_MAX ||
+                !CounterCodec::getVarint(in, end, count) || count != u64(end - in) / sizeof(Key) ||
+                u64(end - in) % sizeof(Key) != 0)
+                return false;
+            rose.total_size_ = total_size;
+            rose.exact_ = true;
+            rose.exact_keys_.resize(count);
+            if (count > 0)
+                memcpy(rose.exact_keys_.data(), in, count * sizeof(Key));
+            if (!std::is_sorted(rose.exact_keys_.begin(), rose.exact_keys_.end()))
+                return false;
+            out = std::move(rose);
+            return true;
+        }
+
+        // 先读出各层描述以确定 arena 大小, 再把计数器直接解码到 arena 中
+        struct LevelHeader
+        {
+            bool dropped;
+            u64 bytes, k, expect_num, insert_num, payload_len;
+            const u8 *payload;
+        };
+        std::vector<LevelHeader> headers(levels);
+        u64 arena_size = 0;
+        for (auto &h : headers)
+        {
+            u8 dropped;
+            if (!get(&dropped, 1) || !CounterCodec::getVarint(in, end, h.k) ||
+                !CounterCodec::getVarint(in, end, h.expect_num) ||
+                !CounterCodec::getVarint(in, end, h.insert_num))
+                return false;
+            h.dropped = dropped;
+            if (h.dropped)
+                continue;
+            if (!CounterCodec::getVarint(in, end, h.bytes) || !CounterCodec::getVarint(in, end, h.payload_len) || h.payload_len > u64(end - in) ||
+                2 > h.bytes || h.bytes > UINT32_MAX || h.k == 0 || h.k > CountingBloomFilter::kMaxProbes ||
+                h.expect_num == 0)
+                return false;
+            h.payload = in;
+            in += h.payload_len;
+            arena_size += roundUp(h.bytes, kCacheLineSize);
+            if (arena_size > max_bytes)
+                return false;
+        }
+
+        // 发送方的缓冲区按键有序、增量为非零的 int, 各层建好后整体经 flushBuffer 写入
+        u64 buffered;
+        if (!CounterCodec::getVarint(in, end, buffered))
+            return false;
+        for (u64 i = 0; i < buffered; ++i)
+        {
+            Key key;
+            u64 zigzag;
+            if (!get(&key, sizeof(Key)) || !CounterCodec::getVarint(in, end, zigzag) || zigzag == 0 ||
+                (zigzag >> 1) > u64(INT_MAX) ||
+                (!rose.write_buffer_.empty() && !(rose.write_buffer_.rbegin()->first < key)))
+                return false;
+            int delta = (zigzag & 1) ? -int(zigzag >> 1) - 1 : int(zigzag >> 1);
+            rose.write_buffer_.emplace_hint(rose.write_buffer_.end(), key, delta);
+        }
+        if (in != end)
+            return false;
+        // 计数器存储或写时复制的页分配失败时放弃解码
+        try
+        {
+            rose.arena_ = std::make_shared<LevelArena>(arena_size, options.huge_pages);
+            rose.bfs.reserve(levels);
+            u64 offset = 0;
+            for (u32 i = 0; i < levels; ++i)
+            {
+                const LevelHeader &h = headers[i];
+                if (h.dropped)
+                {
+                    rose.bfs.emplace_back(nullptr, 0, h.k, h.expect_num, h.insert_num, i);
+                    rose.bfs[i].Drop();
+                    continue;
+                }
+                u8 *dst = rose.arena_->data() + offset;
+                if (!CounterCodec::decode(h.payload, h.payload_len, dst, h.bytes))
+                    return false;
+                rose.bfs.emplace_back(dst, h.bytes, h.k, h.expect_num, h.insert_num, i);
+                if (rose.options_.prefix_local_hashing && i > 0)
+                {
+                    if (h.bytes % CountingBloomFilter::kBlockSize != 0)
+                        return false;
+                    rose.bfs[i].SetPrefixLocal(rose.alpha_ * (levels - i - 1), rose.alpha_);
+                }
+                if (options.snapshots)
+                    rose.bfs[i].EnableSharing(rose.page_bytes_);
+                offset += roundUp(h.bytes, kCacheLineSize);
+            }
+            if (options.snapshots)
+                rose.arena_.reset();
+            if (rose.write_buffer_.size() >= options.write_buffer_keys)
+                rose.flushBuffer();
+        }
+        catch (const std::bad_alloc &)
+        {
+            return false;
+        }
+        out = std::move(rose);
+        return true;
+    }
+
+    template <typename Key>
+    inline bool Rosetta<Key>::range_query(Key low, Key high) const
+    {
+#ifdef ROSETTA_STATS
+        range_queries_.add();
+        queryDepth() = 0;
+#endif
+        if (exact_)
+            return exactMayContain(low, high);
+        if (bufferMayContain(low, high))
+            return true;
+        bool ret;
+        Key anchor = 0;
+        int anchor_level = rangeAnchor(low, high, anchor);
+        if (anchor_level >= 0 && stashCovers(anchor, anchor_level))
+        {
+            ROSETTA_STAT(stash_hits_.add());
+            ret = false;
+        }
+        else if (anchor_level >= 0 && !probeLevel(anchor_level, anchor))
+            ret = false;
+        else if (query_pool_ != nullptr && estimateQueryWork(low, high) >= parallel_work_threshold_)
+            ret = parallel_range_query(low, high, anchor, anchor_level);
+        else
+            ret = visitCoveringPrefixes(low, high, [this, anchor, anchor_level](Key prefix, u32 l) {
+                // 点查询与对齐的范围只有锚点本身一个覆盖前缀, 不再重复探测
+                return doubt(prefix, prefix, l, nullptr, int(l) == anchor_level && prefix == anchor);
+            });
+        ROSETTA_STAT(depth_histogram_[queryDepth()].add());
+        return ret;
+    }
+
+    template <typename Key>
+    template <class Visit>
+    bool Rosetta<Key>::visitCoveringPrefixes(Key low, Key high, Visit &&visit) const
+    {
+        if (low > high)
+            return false;
+        Key diff = low ^ high;
+        if (diff == 0)
+            return visit(low, levels_ - 1);
+        // s 为 low 与 high 第一个不同的层; 左侧沿 low 向下, 右侧沿 high 向下, 中间是第 s 层完整的子节点
+        const u32 s = countLeadingZeros(diff) / alpha_;
+        const u64 max_digit = (u64(1) << alpha_) - 1;
+        const Key parent = s == 0 ? Key(0) : prefixOf(low, s - 1);
+        u64 first = digitOf(low, s), last = digitOf(high, s);
+
+        u32 left = alignedLevel(low, s, 0);
+        u32 right = alignedLevel(high, s, KeyTraits<Key>::max_value);
+        // 范围恰好是第 s - 1 层的一个完整节点
+        if (s > 0 && left == s && right == s && first == 0 && last == max_digit)
+            return visit(parent, s - 1);
+        if (left == s)
+            first--;
+        else
+        {
+            if (visit(low, left))
+                return true;
+            for (u32 l = left; l > s; --l)
+                for (u64 d = digitOf(low, l) + 1; d <= max_digit; ++d)
+                    if (visit(prefixOf(low, l - 1) + (Key(d) << shiftOf(l)), l))
+                        return true;
+        }
+
+        if (right == s)
+            last++;
+        for (u64 d = first + 1; d < last; ++d)
+            if (visit(parent + (Key(d) << shiftOf(s)), s))
+                return true;
+        if (right == s)
+            return false;
+        for (u32 l = s + 1; l <= right; ++l)
+            for (u64 d = 0; d < digitOf(high, l); ++d)
+                if (visit(prefixOf(high, l - 1) + (Key(d) << shiftOf(l)), l))
+                    return true;
+        return visit(prefixOf(high, right), right);
+    }
+
+    template <typename Key>
+    inline bool Rosetta<Key>::range_query(Key low, Key high, Key p, u64 l) const
     {
-        return range_query(low, high, 0, 0);
+        if (exact_)
+            return exactMayContain(low, high);
+        return range_query(low, high, p, l, nullptr);
     }
 
-    inline bool Rosetta::range_query(u64 low, u64 high, u64 p, u64 l)
+    template <typename Key>
+    inline bool Rosetta<Key>::parallel_range_query(Key low, Key high, Key anchor, int anchor_level) const
     {
+        std::vector<std::pair<Key, u32>> prefixes;
+        visitCoveringPrefixes(low, high, [&prefixes](Key prefix, u32 l) {
+            prefixes.push_back({prefix, l});
+            return false;
+        });
+        // 范围恰好是锚点一个节点: 锚点已探测, 直接分发它的子节点
+        bool probed = false;
+        if (prefixes.size() == 1 && anchor_level >= 0)
+        {
+            const u32 l = u32(anchor_level);
+            if (l == levels_ - 1)
+                probed = true;
+            else
+            {
+                prefixes.clear();
+                for (u64 d = 0; d < (u64(1) << alpha_); ++d)
+                    prefixes.push_back({anchor + (Key(d) << shiftOf(l + 1)), l + 1});
+            }
+        }
+
+        std::atomic<bool> found(false);
+        std::atomic<u32> max_depth(0);
+        std::vector<ThreadPool::Task> tasks;
+        for (auto &pl : prefixes)
+        {
+            const Key prefix = pl.first;
+            const u32 l = pl.second;
+            tasks.push_back([this, &found, &max_depth, prefix, l, probed] {
+                if (found.load(std::memory_order_relaxed))
+                    return;
+                ROSETTA_STAT(queryDepth() = 0);
+                bool hit = doubt(prefix, prefix, l, &found, probed);
+                if (hit)
+                    found.store(true, std::memory_order_relaxed);
+#ifdef ROSETTA_STATS
+                u32 depth = max_depth.load(std::memory_order_relaxed);
+                while (queryDepth() > depth && !max_depth.compare_exchange_weak(depth, queryDepth()))
+                    ;
+#endif
+            });
+        }
+        query_pool_->runAll(tasks);
+        ROSETTA_STAT(queryDepth() = max_depth.load());
+        return found.load();
+    }
+
+    template <typename Key>
+    inline bool Rosetta<Key>::range_query(Key low, Key high, Key p, u64 l, const std::atomic<bool> *cancel) const
+    {
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed))
+            return false;
         // printf("level = %lx\n", l);
         if (l == levels_ - 1) {
             l = levels_ - 1;
         }
-        u64 base = 0;
+        Key base = 0;
         u64 move = (levels_ - l - 1) * alpha_;
-        u64 end = pow(2, alpha_) - 1;
-        for (int i = 0; i <= end; ++i, ++base) {
-            u64 next = (l == 0 && i == end) ? UINT64_MAX : (((base + 1) << move) + p - 1);
-            u64 cur = (base << move) + p;
+        u64 end = (u64(1) << alpha_) - 1;
+        for (u64 i = 0; i <= end; ++i, ++base) {
+            Key next = (l == 0 && i == end) ? KeyTraits<Key>::max_value : (((base + 1) << move) + p - 1);
+            Key cur = (base << move) + p;
             // printf("l = %lx, range_query: cur = %lx, next = %lx, low = %lx, high = %lx\n", l, cur, next, low, high);
             if (low > next) continue;
             if (cur > high) break;
             if (low <= cur && next <= high ) {
-                if (doubt(cur, next, l))    return true;
+                if (doubt(cur, next, l, cancel))    return true;
                 continue;
             }
-            if (range_query(low, high, cur, l + 1)) {
+            if (range_query(low, high, cur, l + 1, cancel)) {
                 return true;
             }
         }
         return false;
     }
 
-    inline bool Rosetta::doubt(u64 low, u64 high, u64 l)
+    template <typename Key>
+    inline bool Rosetta<Key>::doubt(Key low, Key high, u64 l, const std::atomic<bool> *cancel, bool probed) const
     {
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed))
+            return false;
         // std::cout << "doubt:" << p << ' ' << l << std::endl;
-        if (!bfs[l]->KeyMayMatch(low))
+        if (!probed && isStashed(low, l))
+        {
+            ROSETTA_STAT(stash_hits_.add());
+            return false;
+        }
+        // 丢弃层下方紧接着仍有未丢弃的层时向下展开一层, 否则直接返回"可能存在",
+        // 避免在连续的丢弃层上逐层展开 2^alpha 个子节点
+        if (bfs[l].IsDropped() && (l == levels_ - 1 || bfs[l + 1].IsDropped()))
+            return true;
+        if (!probed && !probeLevel(l, low))
             return false;
         if (l == levels_ - 1) return true;
-        u64 base = 0;
+        Key base = 0;
         u64 move = (levels_ - l - 2) * alpha_;
-        u64 end = pow(2, alpha_) - 1;
-        for (u32 i = 0; i <= end; i++, ++base) {
-            u64 cur = low + (base << move);
-            u64 next = ((base + 1) << move) + low - 1;
-            if (doubt(cur, next, l + 1))
+        u64 end = (u64(1) << alpha_) - 1;
+        for (u64 i = 0; i <= end; i++, ++base) {
+            Key cur = low + (base << move);
+            Key next = ((base + 1) << move) + low - 1;
+            if (doubt(cur, next, l + 1, cancel))
                 return true;
         }
         return false;
@@ -0,0 +1,248 @@
+// Rosetta 吞吐与延迟基准.
+// 对每种键分布依次测量 insertKey / lookupKey / range_query (每个范围长度一组) / DeleteKey,
+// 输出每组的吞吐与 p50/p99/p999 延迟, 可选地附带 perf_event_open 硬件计数器 (每操作均值).
+//
+// 用法: rosetta_bench [--keys=N] [--queries=N] [--dist=uniform,zipfian,sequential,clustered]
+//                     [--ranges=16,1024,1048576] [--size_mb=N] [--alpha=N] [--beta=X] [--fp=X]
+//                     [--format=csv|json] [--perf] [--huge_pages] [--prefix_local] [--write_buffer=N]
+// 延迟逐个操作用单调时钟测量, 吞吐包含了计时本身约 20ns/op 的开销.
+
+#include <string.h>
+
+#include "PerfCounters.hpp"
+#include "rosetta.hpp"
+#include "workload.hpp"
+
+using namespace elastic_rose;
+
+struct BenchConfig
+{
+    u64 num_keys = 1000000;
+    u64 num_queries = 200000;
+    std::vector<KeyDistribution> dists = {KeyDistribution::kUniform, KeyDistribution::kZipfian,
+                                          KeyDistribution::kSequential, KeyDistribution::kClustered};
+    std::vector<u64> range_lens = {16, 1024, 1048576};
+    u64 size_mb = 16;
+    u32 alpha = 4;
+    double beta = 0.5;
+    double false_positive = 0.01;
+    bool json = false;
+    bool perf = false;
+    RosettaOptions options;
+};
+
+static std::vector<std::string> split(const std::string &s)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= s.size())
+    {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos)
+            end = s.size();
+        if (end > start)
+            parts.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return parts;
+}
+
+static bool parseArgs(int argc, char **argv, BenchConfig &config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--keys")
+            config.num_keys = strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--queries")
+            config.num_queries = strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--size_mb")
+            config.size_mb = strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--alpha")
+            config.alpha = strtoul(value.c_str(), nullptr, 10);
+        else if (name == "--beta")
+            config.beta = strtod(value.c_str(), nullptr);
+        else if (name == "--fp")
+            config.false_positive = strtod(value.c_str(), nullptr);
+        else if (name == "--format")
+            config.json = value == "json";
+        else if (name == "--perf")
+            config.perf = true;
+        else if (name == "--huge_pages")
+            config.options.huge_pages = true;
+        else if (name == "--prefix_local")
+            config.options.prefix_local_hashing = true;
+        else if (name == "--write_buffer")
+            config.options.write_buffer_keys = strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--dist")
+        {
+            config.dists.clear();
+            for (auto &d : split(value))
+            {
+                KeyDistribution dist;
+                if (!parseDistribution(d, dist))
+                {
+                    fprintf(stderr, "unknown distribution %s\n", d.c_str());
+                    return false;
+                }
+                config.dists.push_back(dist);
+            }
+        }
+        else if (name == "--ranges")
+        {
+            config.range_lens.clear();
+            for (auto &r : split(value))
+                config.range_lens.push_back(strtoull(r.c_str(), nullptr, 10));
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    // 构造参数 total_size 为 u32
+    if (config.size_mb == 0 || config.size_mb * 1024 * 1024 > UINT32_MAX)
+    {
+        fprintf(stderr, "--size_mb must be between 1 and %lu\n", u64(UINT32_MAX) / (1024 * 1024));
+        return false;
+    }
+    return true;
+}
+
+class Reporter
+{
+public:
+    Reporter(const BenchConfig &config) : config_(config), perf_(nullptr)
+    {
+        if (config_.perf)
+        {
+            perf_ = new PerfCounters();
+            if (!perf_->available())
+                fprintf(stderr, "perf_event_open unavailable, hardware counters will be 0\n");
+        }
+        if (!config_.json)
+        {
+            printf("dist,op,range_len,ops,throughput_ops_s,positive_rate,p50_ns,p99_ns,p999_ns");
+            if (config_.perf)
+                printf(",cycles_per_op,instructions_per_op,cache_misses_per_op,branch_misses_per_op");
+            printf("\n");
+        }
+    }
+
+    ~Reporter()
+    {
+        delete perf_;
+    }
+
+    // op(i) 返回该次操作的结果 (查询是否为正), 用于统计正例比例
+    template <class Op>
+    void run(KeyDistribution dist, const char *op_name, u64 range_len, u64 n, Op &&op)
+    {
+        std::vector<u64> latency(n);
+        u64 positives = 0;
+        if (perf_)
+            perf_->start();
+        u64 start = getNowNs();
+        for (u64 i = 0; i < n; ++i)
+        {
+            u64 t0 = getNowNs();
+            positives += op(i);
+            latency[i] = getNowNs() - t0;
+        }
+        u64 total = getNowNs() - start;
+        if (perf_)
+            perf_->stop();
+
+        double throughput = n * 1e9 / (total ? total : 1);
+        double positive_rate = n ? double(positives) / n : 0;
+        u64 p50 = percentile(latency, 0.5);
+        u64 p99 = percentile(latency, 0.99);
+        u64 p999 = percentile(latency, 0.999);
+        if (config_.json)
+        {
+            printf("{\"dist\":\"%s\",\"op\":\"%s\",\"range_len\":%lu,\"ops\":%lu,"
+                   "\"throughput_ops_s\":%.1f,\"positive_rate\":%.6f,"
+                   "\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu",
+                   distributionName(dist), op_name, range_len, n, throughput, positive_rate,
+                   p50, p99, p999);
+            if (perf_)
+                printf(",\"cycles_per_op\":%.1f,\"instructions_per_op\":%.1f,"
+                       "\"cache_misses_per_op\":%.3f,\"branch_misses_per_op\":%.3f",
+                       perOp(PerfCounters::kCycles, n), perOp(PerfCounters::kInstructions, n),
+                       perOp(PerfCounters::kCacheMisses, n), perOp(PerfCounters::kBranchMisses, n));
+            printf("}\n");
+        }
+        else
+        {
+            printf("%s,%s,%lu,%lu,%.1f,%.6f,%lu,%lu,%lu", distributionName(dist), op_name, range_len,
+                   n, throughput, positive_rate, p50, p99, p999);
+            if (perf_)
+                printf(",%.1f,%.1f,%.3f,%.3f", perOp(PerfCounters::kCycles, n),
+                       perOp(PerfCounters::kInstructions, n), perOp(PerfCounters::kCacheMisses, n),
+                       perOp(PerfCounters::kBranchMisses, n));
+            printf("\n");
+        }
+        fflush(stdout);
+    }
+
+private:
+    const BenchConfig &config_;
+    PerfCounters *perf_;
+
+    double perOp(PerfCounters::Event e, u64 n) const
+    {
+        return n ? double(perf_->value(e)) / n : 0;
+    }
+};
+
+static void benchDistribution(const BenchConfig &config, Reporter &reporter, KeyDistribution dist)
+{
+    KeyGenerator gen(dist, config.num_keys);
+    std::vector<u64> keys(config.num_keys);
+    for (auto &k : keys)
+        k = gen.next();
+
+    Rosetta<u64> rose(config.size_mb * 1024 * 1024, config.alpha, config.beta,
+                      config.false_positive, config.options);
+
+    reporter.run(dist, "insertKey", 0, keys.size(), [&](u64 i) {
+        rose.insertKey(keys[i]);
+        return true;
+    });
+
+    // 一半查询取已插入的键, 一半取同一分布的新键
+    std::vector<u64> lookups(config.num_queries);
+    for (u64 i = 0; i < lookups.size(); ++i)
+        lookups[i] = (i & 1) ? keys[gen.rng()() % keys.size()] : gen.nextQuery();
+    reporter.run(dist, "lookupKey", 0, lookups.size(),
+                 [&](u64 i) { return rose.lookupKey(lookups[i]); });
+
+    for (u64 range_len : config.range_lens)
+    {
+        std::vector<std::pair<u64, u64>> ranges(config.num_queries);
+        for (auto &r : ranges)
+            r = makeRange(gen.nextQuery(), range_len);
+        reporter.run(dist, "range_query", range_len, ranges.size(),
+                     [&](u64 i) { return rose.range_query(ranges[i].first, ranges[i].second); });
+    }
+
+    u64 deletes = keys.size() / 2;
+    reporter.run(dist, "DeleteKey", 0, deletes, [&](u64 i) {
+        rose.DeleteKey(keys[i]);
+        return true;
+    });
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config))
+        return 1;
+    Reporter reporter(config);
+    for (auto dist : config.dists)
+        benchDistribution(config, reporter, dist);
+    return 0;
+}
@@ -1,13 +1,19 @@
 #include "rosetta.hpp"
+#include "RosettaCoro.hpp"
+
+#include <random>
+#include <set>
+#include <thread>
 
 using namespace elastic_rose;
 using namespace std;
 
-static void test_rose(Rosetta &rose, u64 low, u64 high)
+template <typename Key>
+static void test_rose(Rosetta<Key> &rose, Key low, Key high)
 {
     std::cout << "===============================" << std::endl;
     bool exist = rose.range_query(low, high);
-    printf("low: %ld high: %ld ", low, high);
+    std::cout << "low: " << low << " high: " << high << " ";
     printf("%s\n", exist ? "exist" : "not exist");
 }
 
@@ -19,7 +25,8 @@ static void test_rose(Rosetta &rose, u64 low, u64 high)
 //     printf("%s\n", exist ? "exist" : "not exist");
 // }
 
-void u64_test(Rosetta &rose)
+template <typename Key>
+void u64_test(Rosetta<Key> &rose)
 {
     printf("%d %s\n", 2, rose.lookupKey(2) ? "exist" : "not exist");
     printf("%d %s\n", 13, rose.lookupKey(13) ? "exist" : "not exist");
@@ -29,14 +36,14 @@ void u64_test(Rosetta &rose)
     printf("\n");
 
     // close range query
-    test_rose(rose, 20, 30);
-    test_rose(rose, 23, 24);
-    test_rose(rose, 24, 29);
-    test_rose(rose, 24, 28);
-    test_rose(rose, 40, 73);
-    test_rose(rose, 100, 130);
-    test_rose(rose, 140, 201);
-    test_rose(rose, 210, 220);
+    test_rose<Key>(rose, 20, 30);
+    test_rose<Key>(rose, 23, 24);
+    test_rose<Key>(rose, 24, 29);
+    test_rose<Key>(rose, 24, 28);
+    test_rose<Key>(rose, 40, 73);
+    test_rose<Key>(rose, 100, 130);
+    test_rose<Key>(rose, 140, 201);
+    test_rose<Key>(rose, 210, 220);
 }
 
 // void string_test(Rosetta &rose2)
@@ -53,6 +60,590 @@ void u64_test(Rosetta &rose)
 //     test_rose(rose2, "e", "mark");
 // }
 
+// 并行与串行的范围查询结果必须完全一致
+template <typename Key>
+void parallel_test(Rosetta<Key> &rose)
+{
+    ThreadPool pool(4);
+    std::vector<std::pair<Key, Key>> ranges;
+    for (Key low = 0; low < 4096; low += 37)
+        ranges.push_back({low, low + 500});
+    for (Key t = 1; t < 16; ++t)
+    {
+        Key boundary = t << (KeyTraits<Key>::bits - 4);
+        ranges.push_back({boundary - 3, boundary + 3});
+        ranges.push_back({boundary / 2, boundary});
+    }
+    ranges.push_back({0, KeyTraits<Key>::max_value});
+    ranges.push_back({204, KeyTraits<Key>::max_value});
+    // 落在第 0 层一个子节点内的范围, 以及恰好是一个节点的范围
+    const Key child = Key(1) << (KeyTraits<Key>::bits - rose.getAlpha());
+    ranges.push_back({0, child / 2});
+    ranges.push_back({0, child - 1});
+    ranges.push_back({child, 2 * child - 1});
+    ranges.push_back({3, child / 8});
+    ranges.push_back({5, 5});
+    // 这些范围在默认阈值下也会并行
+    assert(rose.estimateQueryWork(0, child / 2) >= 256);
+    assert(rose.estimateQueryWork(0, child - 1) >= 256);
+    assert(rose.estimateQueryWork(5, 5) < 256);
+    std::vector<bool> expect;
+    for (auto &r : ranges)
+        expect.push_back(rose.range_query(r.first, r.second));
+    rose.setQueryPool(&pool, 0);
+    size_t mismatch = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+        if (rose.range_query(ranges[i].first, ranges[i].second) != expect[i])
+            mismatch++;
+    rose.setQueryPool(nullptr);
+    printf("parallel range query: %zu ranges, %zu mismatches\n", ranges.size(), mismatch);
+    assert(mismatch == 0);
+}
+
+// 原 range_query 递归得到的完全覆盖前缀, 作为查询计划的对照
+template <typename Key>
+static void coveringPrefixes(const Rosetta<Key> &rose, Key low, Key high, Key p, u32 l,
+                             std::vector<std::pair<Key, u32>> &out)
+{
+    u64 move = (rose.getLevels() - l - 1) * rose.getAlpha();
+    u64 end = (u64(1) << rose.getAlpha()) - 1;
+    Key base = 0;
+    for (u64 i = 0; i <= end; ++i, ++base)
+    {
+        Key next = (l == 0 && i == end) ? KeyTraits<Key>::max_value : (((base + 1) << move) + p - 1);
+        Key cur = (base << move) + p;
+        if (low > next)
+            continue;
+        if (cur > high)
+            break;
+        if (low <= cur && next <= high)
+            out.push_back({cur, l});
+        else
+            coveringPrefixes(rose, low, high, cur, l + 1, out);
+    }
+}
+
+// 查询计划访问的前缀与原递归完全相同; 计划多探测的公共前缀只会减少假阳性
+template <typename Key>
+void planner_test(Rosetta<Key> &rose)
+{
+    std::vector<std::pair<Key, Key>> ranges = {{0, KeyTraits<Key>::max_value}, {0, 0}, {5, 5}, {16, 31},
+                                               {15, 32}, {1, KeyTraits<Key>::max_value - 1}};
+    std::mt19937_64 rng(11);
+    for (int i = 0; i < 2000; ++i)
+    {
+        Key low = Key(rng()) << (i % 3 == 0 ? 0 : (rng() % KeyTraits<Key>::bits) / 2);
+        low = i % 2 ? low : Key(rng() % 4096);
+        Key len = Key(1) << (rng() % KeyTraits<Key>::bits);
+        len = len > 1 ? Key(rng()) % len : len;
+        Key high = low + len < low ? KeyTraits<Key>::max_value : low + len;
+        ranges.push_back({low, high});
+    }
+    size_t mismatch = 0, pruned = 0;
+    for (auto &r : ranges)
+    {
+        std::vector<std::pair<Key, u32>> expect, got;
+        coveringPrefixes(rose, r.first, r.second, Key(0), 0, expect);
+        rose.visitCoveringPrefixes(r.first, r.second, [&got](Key prefix, u32 l) {
+            got.push_back({prefix, l});
+            return false;
+        });
+        mismatch += expect != got;
+        std::vector<std::pair<Key, u32>> stepped;
+        for (Key from = r.first;;)
+        {
+            u32 l = rose.coveringLevel(from, r.second);
+            stepped.push_back({from, l});
+            Key end = from | ((Key(1) << ((rose.getLevels() - 1 - l) * rose.getAlpha())) - 1);
+            if (end >= r.second)
+                break;
+            from = end + 1;
+        }
+        mismatch += expect != stepped;
+        bool planned = rose.range_query(r.first, r.second);
+        bool full = rose.range_query(r.first, r.second, 0, 0);
+        mismatch += planned && !full;
+        pruned += full && !planned;
+    }
+#if defined(__cpp_impl_coroutine)
+    std::unique_ptr<bool[]> got(new bool[ranges.size()]);
+    rangeQueriesInterleaved(rose, ranges.data(), ranges.size(), got.get(), 8);
+    for (size_t i = 0; i < ranges.size(); ++i)
+        mismatch += got[i] != rose.range_query(ranges[i].first, ranges[i].second);
+#endif
+    printf("planner: %zu ranges, %zu mismatches, %zu extra negatives\n", ranges.size(), mismatch, pruned);
+    assert(mismatch == 0);
+}
+
+// 编译时加 -DROSETTA_STATS 才会有探测计数
+template <typename Key>
+void stats_test(Rosetta<Key> &rose)
+{
+    rose.resetStats();
+    rose.lookupKey(2);
+    rose.range_query(20, 30);
+    rose.range_query(140, 201);
+    RosettaStats stats = rose.getStats();
+    printf("stats enabled: %s, lookups %lu, range queries %lu\n", stats.enabled ? "yes" : "no",
+           stats.point_lookups, stats.range_queries);
+    for (u32 i = 0; i < rose.getLevels(); ++i)
+    {
+        printf("level %2u load %.6f", i, stats.load_factor[i]);
+        if (stats.enabled)
+            printf(" probes %lu positives %lu saturation %lu capacity %lu depth %lu", stats.probes[i],
+                   stats.positives[i], stats.saturation_events[i], stats.capacity_events[i],
+                   stats.depth_histogram[i]);
+        printf("\n");
+    }
+    if (stats.enabled)
+    {
+        assert(stats.point_lookups == 1 && stats.range_queries == 2);
+        assert(stats.probes[rose.getLevels() - 1] >= 1);
+        // 覆盖前缀就是锚点时只探测一次
+        const u32 last = rose.getLevels() - 1;
+        rose.resetStats();
+        rose.range_query(5, 5);
+        assert(rose.getStats().probes[last] == 1);
+        rose.resetStats();
+        const Key fanout = Key(1) << rose.getAlpha();
+        rose.range_query(fanout, 2 * fanout - 1);
+        assert(rose.getStats().probes[last - 1] == 1);
+    }
+}
+
+// 快照上的查询结果在并发写入与收缩期间保持不变
+void snapshot_test()
+{
+    RosettaOptions options;
+    options.snapshots = true;
+    Rosetta<u64> rose(1024 * 1024, 4, 0.5, 0.01, options);
+    std::vector<u64> keys;
+    for (u64 i = 0; i < 2000; ++i)
+        keys.push_back(i * 7919 * 104729);
+    for (auto k : keys)
+        rose.insertKey(k);
+
+    std::vector<std::pair<u64, u64>> ranges;
+    for (u64 i = 0; i < 2000; ++i)
+        ranges.push_back({i * 3000017, i * 3000017 + i % 1000});
+    auto answers = [&ranges](const Rosetta<u64> &r) {
+        std::vector<bool> out;
+        for (auto &q : ranges)
+            out.push_back(r.range_query(q.first, q.second));
+        return out;
+    };
+
+    // 未开启 snapshots 时不能取快照
+    assert(Rosetta<u64>(4096, 4, 0.5, 0.01).snapshot() == nullptr);
+    std::shared_ptr<const Rosetta<u64>> snap = rose.snapshot();
+    std::vector<bool> expect = answers(*snap);
+    std::thread writer([&] {
+        for (u64 i = 0; i < 2000; ++i)
+        {
+            rose.insertKey(i * 3000017 + 1);
+            rose.DeleteKey(keys[i]);
+        }
+    });
+    size_t mismatch = 0;
+    for (int round = 0; round < 3; ++round)
+        mismatch += answers(*snap) != expect;
+    writer.join();
+    for (int step = 0; step < 20; ++step)
+        rose.shrink();
+    mismatch += answers(*snap) != expect;
+    for (auto k : keys)
+        mismatch += !snap->lookupKey(k);
+
+    // 新插入的键只对写者可见
+    size_t false_negatives = 0, hidden = 0;
+    for (u64 i = 0; i < 2000; ++i)
+    {
+        false_negatives += !rose.lookupKey(i * 3000017 + 1);
+        hidden += !snap->lookupKey(i * 3000017 + 1);
+    }
+    snap.reset();
+    mismatch += answers(*rose.snapshot()) != answers(rose);
+
+    // 写入时复制的页计入内存占用, 快照释放后只被它引用的旧页随之归还
+    u64 base = rose.getMemoryUsage();
+    snap = rose.snapshot();
+    for (u64 i = 0; i < 2000; ++i)
+        rose.insertKey(i * 0x9e3779b97f4a7c15ULL);
+    u64 held = rose.getMemoryUsage();
+    snap.reset();
+    printf("snapshot: %zu mismatches, %zu false negatives, new keys hidden: %s, memory %lu -> %lu -> %lu\n",
+           mismatch, false_negatives, hidden > 1900 ? "yes" : "no", base, held, rose.getMemoryUsage());
+    assert(mismatch == 0 && false_negatives == 0 && hidden > 1900);
+    assert(held > base && rose.getMemoryUsage() == base);
+}
+
+// 写合并缓冲区: 刷新前不能有假阴性, 刷新后各层计数器与直接写入完全相同
+void write_buffer_test()
+{
+    RosettaOptions options;
+    options.write_buffer_keys = 256;
+    Rosetta<u64> direct(1024 * 1024, 4, 0.5, 0.01);
+    Rosetta<u64> buffered(1024 * 1024, 4, 0.5, 0.01, options);
+    std::vector<u64> live;
+    size_t false_negatives = 0;
+    for (u64 i = 0; i < 5000; ++i)
+    {
+        u64 key = i * 0x9e3779b97f4a7c15ULL;
+        direct.insertKey(key);
+        buffered.insertKey(key);
+        if (i % 3 == 0)
+        {
+            // 插入后立即删除的键在缓冲区中抵消
+            direct.DeleteKey(key);
+            buffered.DeleteKey(key);
+        }
+        else if (i % 3 == 1 && !live.empty())
+        {
+            direct.DeleteKey(live.back());
+            buffered.DeleteKey(live.back());
+            live.pop_back();
+            live.push_back(key);
+        }
+        else
+            live.push_back(key);
+        for (size_t j = live.size() > 4 ? live.size() - 4 : 0; j < live.size(); ++j)
+            false_negatives += !buffered.lookupKey(live[j]) + !buffered.range_query(live[j] - 3, live[j] + 3);
+    }
+    size_t pending = buffered.getBufferedKeys();
+    buffered.flush();
+    size_t differ = 0;
+    for (u32 i = 0; i < direct.getLevels(); ++i)
+        differ += memcmp(direct.getLevel(i).data(), buffered.getLevel(i).data(),
+                         buffered.getLevel(i).getMemoryUsage()) != 0;
+    printf("write buffer: %zu pending before flush, %zu false negatives, %zu levels differ\n", pending,
+           false_negatives, differ);
+    assert(pending > 0 && pending < 256 && buffered.getBufferedKeys() == 0);
+    assert(false_negatives == 0 && differ == 0);
+}
+
+template <typename Key>
+static bool sameCounters(const Rosetta<Key> &a, const Rosetta<Key> &b)
+{
+    for (u32 i = 0; i < a.getLevels(); ++i)
+    {
+        const CountingBloomFilter &x = a.getLevel(i), &y = b.getLevel(i);
+        if (x.IsDropped() != y.IsDropped() || x.getMemoryUsage() != y.getMemoryUsage() ||
+            x.GetNumProbes() != y.GetNumProbes() || x.GetInsertNum() != y.GetInsertNum())
+            return false;
+        std::vector<u8> cx(x.getMemoryUsage()), cy(y.getMemoryUsage());
+        x.CopyCounters(cx.data());
+        y.CopyCounters(cy.data());
+        if (cx != cy)
+            return false;
+    }
+    return true;
+}
+
+// 传输格式: 编解码后计数器与查询结果不变, 损坏的数据被拒绝
+void codec_test()
+{
+    RosettaOptions options;
+    options.prefix_local_hashing = true;
+    options.write_buffer_keys = 1024;
+    // 每层各占单独的页, 收缩可以停在只丢弃了部分层的状态
+    options.snapshots = true;
+    Rosetta<u64> rose(1024 * 1024, 4, 0.5, 0.01, options);
+    for (u64 i = 0; i < 3000; ++i)
+        rose.insertKey(i * 0x9e3779b97f4a7c15ULL);
+    rose.flush();
+    for (u64 i = 0; i < 100; ++i)
+    {
+        rose.DeleteKey(i * 0x9e3779b97f4a7c15ULL);
+        rose.insertKey(i * 7);
+    }
+    std::vector<u8> wire;
+    rose.encode(wire);
+
+    Rosetta<u64> copy;
+    bool ok = Rosetta<u64>::decode(wire.data(), wire.size(), copy);
+    rose.flush();
+    size_t mismatch = !ok || !sameCounters(rose, copy);
+    for (u64 i = 0; i < 3000; ++i)
+        mismatch += rose.range_query(i * 1000003, i * 1000003 + i) != copy.range_query(i * 1000003, i * 1000003 + i);
+
+    // 收缩后 (含丢弃的层) 再解码为快照模式
+    while (rose.getDroppedLevels() < 3)
+        rose.shrink();
+    wire.clear();
+    rose.encode(wire);
+    RosettaOptions snapshot_options;
+    snapshot_options.snapshots = true;
+    ok = Rosetta<u64>::decode(wire.data(), wire.size(), copy, snapshot_options);
+    mismatch += !ok || !sameCounters(rose, copy);
+
+    size_t rejected = 0;
+    for (size_t len : {size_t(0), size_t(5), wire.size() / 2, wire.size() - 1})
+        rejected += !Rosetta<u64>::decode(wire.data(), len, copy);
+    wire[0] ^= 1;
+    rejected += !Rosetta<u64>::decode(wire.data(), wire.size(), copy);
+
+    // 恶意输入: 两层各声明 4e9 字节、只含一段全零块; 缓冲区中的增量超出 int
+    RosettaOptions buffer_options;
+    buffer_options.write_buffer_keys = 16;
+    Rosetta<u64> small(4096, 32, 0.5, 0.01, buffer_options);
+    small.insertKey(42);
+    std::vector<u8> hostile;
+    small.encode(hostile);
+    size_t head = 4 + 4 + 8 + 8 + 1;
+    std::vector<u8> huge(hostile.begin(), hostile.begin() + head);
+    for (int level = 0; level < 2; ++level)
+    {
+        huge.push_back(0);
+        for (u64 v : {u64(1), u64(1), u64(0)})
+            CounterCodec::putVarint(huge, v);
+        CounterCodec::putVarint(huge, 4000000000ULL);
+        std::vector<u8> payload = {0};
+        CounterCodec::putVarint(payload, 4000000000ULL / 64);
+        CounterCodec::putVarint(huge, payload.size());
+        huge.insert(huge.end(), payload.begin(), payload.end());
+    }
+    huge.push_back(0);
+    rejected += !Rosetta<u64>::decode(huge.data(), huge.size(), copy);
+    hostile.pop_back(); // 键 42 的增量 +1
+    std::vector<u8> largest = hostile;
+    CounterCodec::putVarint(hostile, u64(1) << 41);
+    rejected += !Rosetta<u64>::decode(hostile.data(), hostile.size(), copy);
+    // int 范围内最大的增量整体写入一次: 插入数一步到位, 而不是逐个插入
+    CounterCodec::putVarint(largest, u64(INT_MAX) << 1);
+    mismatch += !Rosetta<u64>::decode(largest.data(), largest.size(), copy) || !copy.lookupKey(42) ||
+                copy.getLevel(copy.getLevels() - 1).GetInsertNum() != u64(INT_MAX);
+    printf("codec: %zu bytes encoded (%lu raw), %zu mismatches, %zu/7 corrupt inputs rejected\n", wire.size(),
+           rose.getMemoryUsage(), mismatch, rejected);
+    assert(mismatch == 0 && rejected == 7);
+}
+
+// 精确模式: 转换前没有假阳性且只占键本身的空间, 超过上限后转为各层且不丢键
+void exact_test()
+{
+    RosettaOptions options;
+    options.exact_bytes = 64;
+    options.snapshots = true;
+    Rosetta<u64> rose(1024 * 1024, 4, 0.5, 0.01, options);
+    std::vector<u64> keys = {1000, 2000, 2000, 3000, 40000, 1ULL << 60};
+    for (auto key : keys)
+        rose.insertKey(key);
+    rose.DeleteKey(2000);
+    rose.DeleteKey(5);
+    size_t wrong = !rose.isExact() + !rose.lookupKey(2000) + !rose.range_query(2001, 3000);
+    size_t false_positives = 0;
+    for (u64 i = 0; i < 10000; ++i)
+    {
+        u64 low = i * 0x9e3779b97f4a7c15ULL;
+        bool expect = false;
+        for (auto key : keys)
+            expect |= key >= low && key <= low + 500;
+        false_positives += rose.range_query(low, low + 500) && !expect;
+    }
+    u64 exact_memory = rose.getMemoryUsage();
+
+    std::vector<u8> wire;
+    rose.encode(wire);
+    Rosetta<u64> copy;
+    wrong += !Rosetta<u64>::decode(wire.data(), wire.size(), copy) || !copy.isExact();
+    for (u64 low = 0; low < 50000; low += 250)
+        wrong += copy.range_query(low, low + 300) != rose.range_query(low, low + 300);
+#if defined(__cpp_impl_coroutine)
+    std::vector<std::pair<u64, u64>> ranges = {{0, 999}, {999, 1000}, {3001, 39999}, {40000, ~0ULL}};
+    bool got[4];
+    rangeQueriesInterleaved(rose, ranges.data(), ranges.size(), got, 2);
+    for (size_t i = 0; i < ranges.size(); ++i)
+        wrong += got[i] != rose.range_query(ranges[i].first, ranges[i].second);
+#endif
+
+    auto before = rose.snapshot();
+    for (u64 i = 0; i < 1000; ++i)
+        rose.insertKey(i * 7919);
+    for (auto key : keys)
+        wrong += !rose.lookupKey(key);
+    for (u64 i = 0; i < 1000; ++i)
+        wrong += !rose.lookupKey(i * 7919);
+    wrong += rose.isExact() || !before->isExact() || before->lookupKey(7919);
+    printf("exact: %lu bytes for %zu keys (%lu after upgrade, %zu wire bytes), %zu false positives, %zu wrong\n",
+           exact_memory, keys.size(), rose.getMemoryUsage(), wire.size(), false_positives, wrong);
+    assert(exact_memory <= 64 && false_positives == 0 && wrong == 0 && rose.getMemoryUsage() > 1024);
+
+    // 上限不是 2 的幂时, 数组的容量也不超过 exact_bytes
+    RosettaOptions odd;
+    odd.exact_bytes = 100;
+    Rosetta<u64> bounded(1024 * 1024, 4, 0.5, 0.01, odd);
+    u64 peak = 0;
+    for (u64 i = 0; i < 100 / sizeof(u64); ++i)
+    {
+        bounded.insertKey(i * 7919);
+        peak = std::max(peak, bounded.getMemoryUsage());
+    }
+    printf("exact: %lu bytes peak for %zu keys under a 100 byte limit\n", peak, 100 / sizeof(u64));
+    assert(bounded.isExact() && peak <= 100);
+    bounded.insertKey(1);
+    assert(!bounded.isExact());
+}
+
+// 空前缀表: 标记为空的假阳性范围不再命中, 之后插入其中的键不会产生假阴性
+void stash_test()
+{
+    RosettaOptions options;
+    options.empty_stash_entries = 1024;
+    Rosetta<u64> rose(16 * 1024, 4, 0.5, 0.01, options);
+    std::set<u64> keys;
+    for (u64 i = 1; i <= 2000; ++i)
+    {
+        keys.insert(i * 0x9e3779b97f4a7c15ULL);
+        rose.insertKey(i * 0x9e3779b97f4a7c15ULL);
+    }
+    auto empty = [&keys](u64 low, u64 high) {
+        auto it = keys.lower_bound(low);
+        return it == keys.end() || *it > high;
+    };
+    std::vector<std::pair<u64, u64>> false_positives;
+    for (u64 i = 0; i < 20000 && false_positives.size() < 100; ++i)
+    {
+        u64 low = i * 0xc2b2ae3d27d4eb4fULL, high = low + (i % 1000);
+        if (high >= low && empty(low, high) && rose.range_query(low, high))
+            false_positives.push_back({low, high});
+    }
+    for (auto &r : false_positives)
+        rose.markEmpty(r.first, r.second);
+    size_t repeated = 0;
+    for (auto &r : false_positives)
+        repeated += rose.range_query(r.first, r.second);
+    size_t stashed = rose.getStashedPrefixes();
+#if defined(__cpp_impl_coroutine)
+    std::unique_ptr<bool[]> got(new bool[false_positives.size()]);
+    rangeQueriesInterleaved(rose, false_positives.data(), false_positives.size(), got.get(), 8);
+    for (size_t i = 0; i < false_positives.size(); ++i)
+        repeated += got[i];
+#endif
+
+    // 插入落在已标记的范围内, 对应的记录失效
+    size_t false_negatives = 0;
+    for (size_t i = 0; i < false_positives.size(); i += 2)
+    {
+        u64 key = false_positives[i].first + (false_positives[i].second - false_positives[i].first) / 2;
+        rose.insertKey(key);
+        false_negatives += !rose.range_query(false_positives[i].first, false_positives[i].second) +
+                           !rose.lookupKey(key);
+    }
+    for (auto key : keys)
+        false_negatives += !rose.lookupKey(key) + !rose.range_query(key - 5, key + 5);
+    printf("stash: %zu false positives marked, %zu prefixes stashed (%zu after inserts), %zu repeated, "
+           "%zu false negatives\n",
+           false_positives.size(), stashed, rose.getStashedPrefixes(), repeated, false_negatives);
+    assert(!false_positives.empty() && stashed <= 1024 && repeated == 0 && false_negatives == 0);
+    assert(rose.getStashedPrefixes() < stashed);
+}
+
+// 构造参数 total_size 是各层总字节数的上限, 取整造成的损失很小
+void size_test()
+{
+    for (u32 total : {64u << 20, 8u << 20, 1u << 20, 100000u, 64u << 10})
+    {
+        Rosetta<u64> rose(total, 4, 0.5, 0.01);
+        u64 sum = 0;
+        for (u32 i = 0; i < rose.getLevels(); ++i)
+            sum += rose.getLevel(i).getMemoryUsage();
+        printf("total_size %8u: levels %8lu bytes\n", total, sum);
+        assert(sum <= total && sum >= total - total / 50);
+    }
+}
+
+// 前缀局部哈希: 删除、折半与丢弃层之后留下的键都没有假阴性
+void prefix_local_test()
+{
+    RosettaOptions options;
+    options.prefix_local_hashing = true;
+    // 快照模式下每层各占单独的页, 丢弃一层就能空出页, 可以停在只丢弃了部分层的状态
+    options.snapshots = true;
+    Rosetta<u64> rose(256 * 1024, 4, 0.5, 0.01, options);
+    std::vector<u64> keys;
+    for (u64 i = 1; i <= 4000; ++i)
+        keys.push_back(i * 0x9e3779b97f4a7c15ULL);
+    for (auto k : keys)
+        rose.insertKey(k);
+    for (size_t i = 0; i < keys.size(); i += 2)
+        rose.DeleteKey(keys[i]);
+    auto falseNegatives = [&rose, &keys] {
+        size_t n = 0;
+        for (size_t i = 1; i < keys.size(); i += 2)
+        {
+            u64 k = keys[i];
+            n += !rose.lookupKey(k) + !rose.range_query(k & ~7ULL, k | 7) +
+                 !rose.range_query(k & ~0xffffULL, k | 0xffff);
+        }
+        return n;
+    };
+    size_t false_negatives = falseNegatives();
+    size_t folds = 0;
+    while (folds < 40 && rose.shrink(ShrinkMode::kFold) > 0)
+    {
+        folds++;
+        false_negatives += falseNegatives();
+    }
+    // 折半后的插入沿用折半后的块映射
+    for (size_t i = 1; i < keys.size(); i += 2)
+        rose.insertKey(keys[i] + 1);
+    for (size_t i = 1; i < keys.size(); i += 2)
+        false_negatives += !rose.lookupKey(keys[i] + 1);
+    // 默认方式先把各层折半到底, 再丢弃层
+    size_t steps = 0;
+    while (rose.getDroppedLevels() < 3 && rose.shrink() > 0)
+    {
+        steps++;
+        false_negatives += falseNegatives();
+    }
+    printf("prefix local: %zu folds, %zu more steps to drop %u levels, %zu false negatives\n", folds, steps,
+           rose.getDroppedLevels(), false_negatives);
+    assert(folds > 0 && rose.getDroppedLevels() == 3 && false_negatives == 0);
+}
+
+#if defined(__cpp_impl_coroutine)
+// 协程交错执行的结果必须与 lookupKey / range_query 一致 (需 -std=c++20)
+template <typename Key>
+void coro_test(Rosetta<Key> &rose)
+{
+    std::vector<Key> keys;
+    std::vector<std::pair<Key, Key>> ranges;
+    for (Key k = 0; k < 300; ++k)
+    {
+        keys.push_back(k);
+        ranges.push_back({k, k + k % 40});
+    }
+    std::unique_ptr<bool[]> got(new bool[keys.size()]);
+    size_t mismatch = 0;
+    lookupKeysInterleaved(rose, keys.data(), keys.size(), got.get(), 8);
+    for (size_t i = 0; i < keys.size(); ++i)
+        mismatch += got[i] != rose.lookupKey(keys[i]);
+    rangeQueriesInterleaved(rose, ranges.data(), ranges.size(), got.get(), 8);
+    for (size_t i = 0; i < ranges.size(); ++i)
+        mismatch += got[i] != rose.range_query(ranges[i].first, ranges[i].second);
+    // 协程版本的单个查询
+    InterleavedScheduler scheduler(8);
+    scheduler.run(keys.size(), [&](size_t i) { return lookupTask(rose, keys[i]); }, got.get());
+    for (size_t i = 0; i < keys.size(); ++i)
+        mismatch += got[i] != rose.lookupKey(keys[i]);
+    auto rangeTasks = [&] {
+        InterleavedScheduler worker_scheduler(8);
+        worker_scheduler.run(
+            ranges.size(), [&](size_t i) { return rangeQueryTask(rose, ranges[i].first, ranges[i].second); },
+            got.get());
+    };
+    rangeTasks();
+    for (size_t i = 0; i < ranges.size(); ++i)
+        mismatch += got[i] != rose.range_query(ranges[i].first, ranges[i].second);
+    // 其他线程上的协程帧在线程退出时归还 (用 -fsanitize=address 编译可检查泄漏)
+    std::thread worker(rangeTasks);
+    worker.join();
+    for (size_t i = 0; i < ranges.size(); ++i)
+        mismatch += got[i] != rose.range_query(ranges[i].first, ranges[i].second);
+    printf("interleaved queries: %zu mismatches\n", mismatch);
+    assert(mismatch == 0);
+}
+#endif
+
 int main(int argc, char **argv)
 {
 
@@ -62,7 +653,7 @@ int main(int argc, char **argv)
 
     std::vector<uint64_t> keys = {2, 3, 13, 19, 23, 29, 31, 37, 123, 202, 203};
     // u64 keys[] = {123};
-    Rosetta rose = Rosetta(8 * 1024 * 1024, 4, 0.5, 0.01);
+    Rosetta<u64> rose(8 * 1024 * 1024, 4, 0.5, 0.01);
     for (auto key : keys) {
       rose.insertKey(key);
     }
@@ -75,6 +666,71 @@ int main(int argc, char **argv)
     }
     std::cout << "=========after=========" << std::endl;
     u64_test(rose);
+
+    std::cout << "=========parallel=========" << std::endl;
+    parallel_test(rose);
+
+    std::cout << "=========planner=========" << std::endl;
+    planner_test(rose);
+
+    std::cout << "=========stats=========" << std::endl;
+    stats_test(rose);
+
+    std::cout << "=========snapshot=========" << std::endl;
+    snapshot_test();
+
+    std::cout << "=========write buffer=========" << std::endl;
+    write_buffer_test();
+
+    std::cout << "=========codec=========" << std::endl;
+    codec_test();
+
+    std::cout << "=========exact=========" << std::endl;
+    exact_test();
+
+    std::cout << "=========stash=========" << std::endl;
+    stash_test();
+
+    std::cout << "=========size=========" << std::endl;
+    size_test();
+
+    std::cout << "=========prefix local=========" << std::endl;
+    prefix_local_test();
+
+#if defined(__cpp_impl_coroutine)
+    std::cout << "=========coroutine=========" << std::endl;
+    coro_test(rose);
+    // 前缀局部哈希的探测位置在同一块中
+    RosettaOptions local_options;
+    local_options.prefix_local_hashing = true;
+    Rosetta<u64> local(256 * 1024, 4, 0.5, 0.01, local_options);
+    for (u64 k = 0; k < 300; k += 3)
+        local.insertKey(k);
+    coro_test(local);
+#endif
+
+    std::cout << "=========u32=========" << std::endl;
+    Rosetta<u32> rose32(1024 * 1024, 4, 0.5, 0.01);
+    std::cout << "levels: " << rose32.getLevels() << std::endl;
+    for (auto key : keys) {
+      rose32.insertKey(key);
+    }
+    u64_test(rose32);
+    test_rose<u32>(rose32, 0xfffffff0, 0xffffffff);
+    planner_test(rose32);
+
+    std::cout << "=========u128=========" << std::endl;
+    Rosetta<u128> rose128(8 * 1024 * 1024, 4, 0.5, 0.01);
+    std::cout << "levels: " << rose128.getLevels() << std::endl;
+    u128 high_bits = u128(0xdeadbeef) << 64;
+    for (auto key : keys) {
+      rose128.insertKey(high_bits | key);
+    }
+    test_rose<u128>(rose128, high_bits | 20, high_bits | 30);
+    test_rose<u128>(rose128, high_bits | 210, high_bits | 220);
+    test_rose<u128>(rose128, 20, 30);
+    test_rose<u128>(rose128, high_bits, KeyTraits<u128>::max_value);
+    planner_test(rose128);
     // std::vector<uint64_t> keys = {6989586621679009792, 7017452644373364736, 7061644215716937728};
     // Rosetta rose = Rosetta(keys, keys.size());
     // test_rose(rose, 6989586621679009792, 7061644215716937728);
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "configuration.hpp"
+
+namespace elastic_rose
+{
+    // 基准测试与参数探索共用的键分布
+    enum class KeyDistribution
+    {
+        kUniform,    // 整个 u64 空间上均匀分布
+        kZipfian,    // 值域 [0, universe) 上 theta = 0.99 的 Zipf 分布, 小值更热
+        kSequential, // 从随机起点开始的连续键
+        kClustered,  // 若干随机簇, 每簇内在 2^cluster_bits 宽的区间中均匀分布
+    };
+
+    inline const char *distributionName(KeyDistribution dist)
+    {
+        switch (dist)
+        {
+        case KeyDistribution::kUniform:
+            return "uniform";
+        case KeyDistribution::kZipfian:
+            return "zipfian";
+        case KeyDistribution::kSequential:
+            return "sequential";
+        case KeyDistribution::kClustered:
+            return "clustered";
+        }
+        return "unknown";
+    }
+
+    inline bool parseDistribution(const std::string &name, KeyDistribution &dist)
+    {
+        for (auto d : {KeyDistribution::kUniform, KeyDistribution::kZipfian,
+                       KeyDistribution::kSequential, KeyDistribution::kClustered})
+            if (name == distributionName(d))
+            {
+                dist = d;
+                return true;
+            }
+        return false;
+    }
+
+    // YCSB 的 Zipf 生成器 (Gray et al., "Quickly Generating Billion-Record Synthetic Databases")
+    class ZipfianGenerator
+    {
+    public:
+        ZipfianGenerator(u64 n, double theta = 0.99) : n_(n), theta_(theta)
+        {
+            zetan_ = zeta(n_);
+            double zeta2 = zeta(2);
+            alpha_ = 1.0 / (1.0 - theta_);
+            eta_ = (1 - std::pow(2.0 / n_, 1 - theta_)) / (1 - zeta2 / zetan_);
+        }
+
+        template <class Rng>
+        u64 next(Rng &rng)
+        {
+            double u = std::uniform_real_distribution<double>(0, 1)(rng);
+            double uz = u * zetan_;
+            if (uz < 1.0)
+                return 0;
+            if (uz < 1.0 + std::pow(0.5, theta_))
+                return 1;
+            u64 r = u64(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+            return r < n_ ? r : n_ - 1;
+        }
+
+    private:
+        u64 n_;
+        double theta_, zetan_, alpha_, eta_;
+
+        double zeta(u64 n) const
+        {
+            double sum = 0;
+            for (u64 i = 1; i <= n; ++i)
+                sum += 1.0 / std::pow(double(i), theta_);
+            return sum;
+        }
+    };
+
+    // 按给定分布产生键; 同一个生成器既用于构造键集, 也用于产生查询的起点
+    class KeyGenerator
+    {
+    public:
+        KeyGenerator(KeyDistribution dist, u64 num_keys, u64 seed = 42)
+            : dist_(dist), rng_(seed), zipf_(dist == KeyDistribution::kZipfian ? num_keys * 10 : 2)
+        {
+            sequential_start_ = sequential_next_ = rng_() >> 1;
+            for (u64 i = 0; i < kClusters; ++i)
+                cluster_base_.push_back(rng_() & ~((u64(1) << kClusterBits) - 1));
+        }
+
+        u64 next()
+        {
+            switch (dist_)
+            {
+            case KeyDistribution::kUniform:
+                return rng_();
+            case KeyDistribution::kZipfian:
+                return zipf_.next(rng_);
+            case KeyDistribution::kSequential:
+                return sequential_next_++;
+            case KeyDistribution::kClustered:
+                return cluster_base_[rng_() % kClusters] + (rng_() & ((u64(1) << kClusterBits) - 1));
+            }
+            return 0;
+        }
+
+        // 查询起点: 顺序分布下在已生成的区间附近均匀选取, 其余分布与键相同
+        u64 nextQuery()
+        {
+            if (dist_ == KeyDistribution::kSequential)
+            {
+                u64 span = sequential_next_ - sequential_start_;
+                return sequential_start_ + rng_() % (span * 2 + 1);
+            }
+            return next();
+        }
+
+        std::mt19937_64 &rng() { return rng_; }
+
+    private:
+        static const u64 kClusters = 16;
+        static const u32 kClusterBits = 24;
+
+        KeyDistribution dist_;
+        std::mt19937_64 rng_;
+        ZipfianGenerator zipf_;
+        u64 sequential_start_;
+        u64 sequential_next_;
+        std::vector<u64> cluster_base_;
+    };
+
+    inline std::vector<u64> generateKeys(KeyDistribution dist, u64 num_keys, u64 seed = 42)
+    {
+        KeyGenerator gen(dist, num_keys, seed);
+        std::vector<u64> keys(num_keys);
+        for (auto &k : keys)
+            k = gen.next();
+        return keys;
+    }
+
+    // [low, low + range_len - 1], 在 u64 上限处截断
+    inline std::pair<u64, u64> makeRange(u64 low, u64 range_len)
+    {
+        u64 high = low + (range_len - 1);
+        if (high < low)
+            high = ~u64(0);
+        return {low, high};
+    }
+
+    // 以 p (0~1) 取分位数, 会对 samples 排序
+    inline u64 percentile(std::vector<u64> &samples, double p)
+    {
+        if (samples.empty())
+            return 0;
+        std::sort(samples.begin(), samples.end());
+        size_t idx = size_t(p * (samples.size() - 1) + 0.5);
+        return samples[std::min(idx, samples.size() - 1)];
+    }
+} // namespace elastic_rose